@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Decodes a history download (debug command 0x6873, port 0x48), see src/history.cpp for the format.
+# Input: one received packet payload per line as hex, e.g. "ffff3f01600906" for the info packet.
+# Output: CSV with time, room temperature (degC), nominal temperature (degC) and valve flow (0-255).
+# Times assume one entry per interval; a reset in between shifts the older entries.
+import sys
+import time
+import struct
+
+HEAD = 0x80
+END = 0xFF
+ABSOLUTE = 14
+DELTA_MIN = -7
+OFFSET = 4000
+INFO = 0xFFFF
+
+
+def parse(lines):
+	info = None
+	data = {}
+	for line in lines:
+		line = line.strip()
+		if not line:
+			continue
+		payload = bytes.fromhex(line)
+		offset, = struct.unpack_from('<H', payload)
+		if offset == INFO:
+			info = dict(zip(('size', 'interval', 'age'), struct.unpack_from('<HHH', payload, 2)))
+		else:
+			data[offset] = payload[2:]
+	if info is None:
+		raise SystemExit('no info packet')
+	ring = bytearray([END] * info['size'])
+	for offset, chunk in data.items():
+		ring[offset:offset + len(chunk)] = chunk
+	received = sum(len(chunk) for chunk in data.values())
+	if received < info['size']:
+		sys.stderr.write('%d of %d bytes received\n' % (received, info['size']))
+	return info, ring
+
+
+def entries(ring):
+	# Splits the ring into entries (head byte, continuation bytes), skips unused and cut bytes.
+	entry = None
+	for b in ring:
+		if b == END:
+			if entry is not None:
+				yield entry
+			entry = None
+		elif b & HEAD:
+			if entry is not None:
+				yield entry
+			entry = [b]
+		elif entry is not None:
+			entry.append(b)
+	if entry is not None:
+		yield entry
+
+
+def decode(ring):
+	# Returns a list of (temperature, setpoint, flow) per entry, None where not decodable yet.
+	result = []
+	temperature = None
+	setpoint = None
+	for entry in entries(ring):
+		code = (entry[0] >> 3) & 0x0F
+		flow = (entry[0] & 0x07) << 5
+		rest = entry[1:]
+		if code == ABSOLUTE and len(rest) >= 2:
+			temperature = ((rest[0] << 7) | rest[1]) - OFFSET
+			rest = rest[2:]
+		elif code < ABSOLUTE:
+			if temperature is not None:
+				temperature += (code + DELTA_MIN) * 10
+		else:
+			temperature = None
+		if rest:
+			setpoint = rest[0] * 25
+		if temperature is None:
+			result.append(None)
+		else:
+			result.append((temperature, setpoint, flow))
+	return result
+
+
+def main():
+	at = time.time()
+	if len(sys.argv) > 1:
+		at = float(sys.argv[1])
+	info, ring = parse(sys.stdin)
+	samples = decode(ring)
+	print('time,temperature,setpoint,flow')
+	for i, sample in enumerate(samples):
+		if sample is None:
+			continue
+		if info['age'] == 0xFFFF:
+			when = '#%d' % i
+		else:
+			t = at - info['age'] - (len(samples) - 1 - i) * info['interval']
+			when = time.strftime('%Y-%m-%d %H:%M', time.localtime(t))
+		temperature, setpoint, flow = sample
+		print('%s,%.2f,%s,%d' % (when, temperature / 100.0,
+			'' if setpoint is None else '%.2f' % (setpoint / 100.0), flow))
+
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,7 @@
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+/* The simulation is single threaded, interrupt handlers become plain functions. */
+#define ISR(vector) extern "C" void vector(void); extern "C" void vector(void)
+#define sei()
+#define cli()
+#endif
@@ -0,0 +1,202 @@
+/* Host replacement for <avr/io.h>: registers are plain variables.
+ * Only the registers and bits used by the firmware modules linked into the simulator are provided. */
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+/* ADSC is cleared immediately, conversions finish at once. */
+struct sim_adcsra_t
+{
+    uint8_t value;
+    sim_adcsra_t &operator=(uint8_t v) { value = v & ~(1 << 6); return *this; }
+    sim_adcsra_t &operator&=(uint8_t v) { value &= v; return *this; }
+    sim_adcsra_t &operator|=(uint8_t v) { value |= v & ~(1 << 6); return *this; }
+    operator uint8_t() const { return value; }
+};
+
+/* ADC result is provided by the simulation for the channel selected in ADMUX. */
+uint16_t simAdc(uint8_t channel);
+struct sim_adc_t
+{
+    operator uint16_t() const;
+};
+
+/* SPI transfers go to the simulated peripheral (sim_spi, see link.cpp), they complete at once. */
+extern uint8_t (*sim_spi)(uint8_t mosi);
+struct sim_spdr_t
+{
+    uint8_t value;
+    sim_spdr_t &operator=(uint8_t v);
+    operator uint8_t() const { return value; }
+};
+
+/* Output port which reports its changes (sim_port_hook), for chip selects and enable lines. */
+extern void (*sim_port_hook)(uint8_t port);
+struct sim_port_t
+{
+    uint8_t value;
+    sim_port_t &operator=(uint8_t v) { value = v; if (sim_port_hook) sim_port_hook(v); return *this; }
+    sim_port_t &operator&=(int v) { return *this = value & v; }
+    sim_port_t &operator|=(int v) { return *this = value | v; }
+    operator uint8_t() const { return value; }
+};
+
+extern volatile uint8_t PINA, PORTA, DDRA, PINB, PORTB, DDRB, PINC, PORTC, DDRC, PIND, PORTD, DDRD;
+extern volatile uint8_t PINE, PORTE, DDRE, PINF, DDRF, PING, PORTG, DDRG;
+extern sim_port_t PORTF;
+extern volatile uint8_t PRR, SREG, MCUCR, MCUSR, SMCR, CLKPR, OSCCAL, GPIOR0, GPIOR1, GPIOR2;
+extern volatile uint8_t ADMUX, ADCSRB, DIDR0, DIDR1;
+extern sim_adcsra_t ADCSRA;
+extern sim_adc_t ADC;
+extern volatile uint8_t EIMSK, EIFR, PCMSK0, PCMSK1;
+extern volatile uint8_t LCDCRA, LCDCRB, LCDFRR, LCDCCR;
+extern volatile uint8_t LCDDR0, LCDDR1, LCDDR2, LCDDR3, LCDDR4, LCDDR5, LCDDR6, LCDDR7, LCDDR8, LCDDR9;
+extern volatile uint8_t LCDDR10, LCDDR11, LCDDR12, LCDDR13, LCDDR14, LCDDR15, LCDDR16, LCDDR17, LCDDR18;
+extern volatile uint8_t SPCR, SPSR;
+extern sim_spdr_t SPDR;
+extern volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+extern volatile uint16_t UBRR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+extern volatile uint16_t TCNT1;
+extern volatile uint8_t TCCR2A, TCNT2, OCR2A, ASSR, TIMSK2, TIFR2;
+extern volatile uint8_t EECR, EEDR;
+extern volatile uint16_t EEAR;
+
+/* Port pins */
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PE6 6
+#define PE7 7
+#define PF0 0
+#define PF1 1
+#define PF2 2
+#define PF3 3
+#define PF4 4
+#define PF5 5
+#define PF6 6
+#define PF7 7
+
+/* PRR */
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRLCD 4
+
+/* ADC */
+#define REFS1 7
+#define REFS0 6
+#define ADEN 7
+#define ADSC 6
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+/* Interrupts */
+#define PCIE1 7
+#define PCIE0 6
+#define PCIF1 7
+#define PCIF0 6
+
+/* LCD */
+#define LCDEN 7
+#define LCDAB 6
+#define LCDIF 4
+#define LCDIE 3
+#define LCDBL 0
+#define LCDCS 7
+#define LCDMUX1 5
+#define LCDMUX0 4
+#define LCDPM2 2
+#define LCDPM1 1
+#define LCDPM0 0
+#define LCDCD0 0
+#define LCDDC2 7
+#define LCDDC1 6
+#define LCDDC0 5
+#define LCDCC0 0
+
+/* SPI */
+#define SPE 6
+#define MSTR 4
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define SPI2X 0
+
+/* USART */
+#define U2X0 1
+#define UDRE0 5
+#define TXC0 6
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ01 2
+#define UCSZ00 1
+
+/* Timers */
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define TOV1 0
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM21 3
+#define AS2 3
+#define TCN2UB 2
+#define OCR2UB 1
+#define TCR2UB 0
+#define TOIE2 0
+#define OCIE2A 1
+#define TOV2 0
+#define OCF2A 1
+
+/* System */
+#define CLKPCE 7
+#define CLKPS3 3
+#define CLKPS2 2
+#define CLKPS1 1
+#define CLKPS0 0
+#define BODS 6
+#define BODSE 5
+#define PUD 4
+#define SM2 3
+#define SM1 2
+#define SM0 1
+#define SE 0
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+#define EERIE 3
+#define EEMWE 2
+#define EEWE 1
+#define EERE 0
+
+#define E2END 511
+
+#endif
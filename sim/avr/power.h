@@ -0,0 +1,6 @@
+#ifndef SIM_AVR_POWER_H_
+#define SIM_AVR_POWER_H_
+/* The host has no clock to scale, clock.cpp only keeps track of the prescaler. */
+typedef enum { clock_div_1 = 0, clock_div_2, clock_div_4, clock_div_8 } clock_div_t;
+#define clock_prescale_set(div)
+#endif
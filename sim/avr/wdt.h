@@ -0,0 +1,7 @@
+#ifndef SIM_AVR_WDT_H_
+#define SIM_AVR_WDT_H_
+#define WDTO_15MS 0
+#define wdt_enable(timeout)
+#define wdt_reset()
+#define wdt_disable()
+#endif
@@ -0,0 +1,523 @@
+/* Base station stand-in for the radio link emulator (link.cpp), reads frames on stdin and answers on
+ * stdout, see link.cpp for the lines.
+ *
+ * Per node it reassembles packets, caches the descriptors and checks them against the schema hash at the
+ * end of each value packet (CRC-CCITT over the descriptors as sent, see Radio::init()). An unknown schema
+ * asks for the descriptions (debug command 0x6473). After each report and each poll (port 0x51, sent when
+ * nothing changed) it answers with what is queued for the node: the time on first contact and once a day
+ * (SetTime), a set-point every -c seconds alternating between two temperatures (SetTemp) and a history
+ * download every -d seconds (debug command 0x6873).
+ * On first contact it also stores a weekly program and the rest temperature and reads the program back
+ * every -r seconds (debug commands 0x7073, 0x7274, 0x7067). Slots which differ from what it sent are sent
+ * again. The program includes a one-shot slot early on Monday, which has to be gone afterwards.
+ * Unless -n is given, the first control goes with the ACK (ACK payload, RADIO_CONTROL_MORE
+ * if more follow) and the rest into the listen window. Without a control one debug command goes with the
+ * ACK and the rest waits for the next report or poll. -n is for nodes built with RADIO_ACK_PAYLOAD 0, which
+ * listen after each report and poll.
+ *
+ *   basestation [-n] [-v] [-c seconds] [-d seconds] [-r seconds]
+ *
+ * -v logs the decoded values to stderr, a summary per node is printed at the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <util/crc16.h>
+
+#include "sensor.h"
+
+/* Ports, control bits and debug commands as in radio.cpp */
+#define BASE_CONTROL_PORT 0
+#define BASE_DEBUG_PORT 0xfe
+#define BASE_SET_TIME (1 << 0)
+#define BASE_SET_TEMPERATURE (1 << 1)
+#define BASE_MORE (1 << 15)
+#define BASE_DESCRIPTIONS 0x6473
+#define BASE_HISTORY 0x6873
+#define BASE_HISTORY_PORT 0x48
+#define BASE_PROGRAM_SET 0x7073
+#define BASE_PROGRAM_GET 0x7067
+#define BASE_PROGRAM_REST 0x7274
+#define BASE_PROGRAM_PORT 0x50
+#define BASE_POLL_PORT 0x51
+#define BASE_PROGRAM_ALL 0xFF /* read: all slots and the rest temperature, answer: the rest temperature */
+#define BASE_CONTROL_SIZE 10 /* bitmask, timestamp, temperature, valve */
+#define BASE_DEBUG_SIZE 8 /* command, data */
+#define BASE_DEBUG_DATA 6
+
+#define BASE_NODES 256
+#define BASE_DESCRIPTORS 32
+#define BASE_QUEUE 16
+#define BASE_PACKET 128
+#define BASE_LINE 256
+#define BASE_EPOCH 1704067200ULL /* Monday 2024-01-01 00:00, the start of the simulation */
+#define BASE_SYNC_US (24 * 3600ULL * 1000000) /* SetTime */
+#define BASE_TEMPERATURE_HIGH 2100
+#define BASE_TEMPERATURE_LOW 1800
+
+/* Weekly program as in program.h: days (bit 7: once), start, end (hour * 8 + eighth), temperature (0.25 degC) */
+#define BASE_SLOTS 16
+#define BASE_SLOT_SIZE 4
+#define BASE_ONCE 0x80
+#define BASE_REST (17 * 4)
+#define BASE_ONCE_SLOT 3
+#define BASE_ONCE_END_US (2 * 3600ULL * 1000000) /* Monday 02:00 */
+static const uint8_t Program[BASE_SLOTS][BASE_SLOT_SIZE] = {
+    { 0x1F, 6 * 8, 8 * 8, 21 * 4 }, /* Monday to Friday 6:00 - 8:00 */
+    { 0x1F, 17 * 8, 22 * 8, 21 * 4 },
+    { 0x60, 8 * 8, 23 * 8, 21 * 4 }, /* weekend */
+    { BASE_ONCE | 0x01, 1 * 8, 2 * 8, 23 * 4 }, /* BASE_ONCE_SLOT: Monday 1:00 - 2:00, once */
+};
+
+struct command_t
+{
+    uint64_t queued; /* us */
+    uint8_t port;
+    uint16_t value; /* BASE_CONTROL_PORT: bitmask, BASE_DEBUG_PORT: command */
+    int16_t temperature;
+    uint8_t data[BASE_DEBUG_DATA]; /* BASE_DEBUG_PORT */
+};
+
+struct node_t
+{
+    uint8_t seen;
+    sensor_info descriptors[BASE_DESCRIPTORS];
+    uint8_t descriptor_count;
+    uint8_t fresh; /* the next descriptor starts a new set */
+    uint8_t packet[BASE_PACKET];
+    uint8_t packet_size;
+    uint64_t synced;
+    uint64_t next_temperature;
+    uint64_t next_history;
+    uint64_t next_program;
+    uint8_t high;
+    command_t queue[BASE_QUEUE];
+    uint8_t queued;
+    uint32_t reports, polls, decoded, unknown, commands, again, history;
+    uint32_t slots, slots_resent; /* program answers, slots sent again as they differed */
+    uint8_t once_seen, once_cleared, once_stale; /* the one-shot slot before and after its end */
+};
+
+static node_t nodes[BASE_NODES];
+static uint8_t ack_payload = 1;
+static uint8_t verbose;
+static uint64_t temperature_period = 3 * 3600ULL * 1000000;
+static uint64_t history_period = 12 * 3600ULL * 1000000;
+static uint64_t program_period = 6 * 3600ULL * 1000000;
+
+static uint8_t sizeOf(uint8_t size)
+{
+    static const uint8_t Sizes[] = { 1, 1, 2, 2, 4, 4 };
+    return size < sizeof(Sizes) ? Sizes[size] : 0;
+}
+
+static void queue(node_t *n, const command_t *c, uint8_t front)
+{
+    if (n->queued == BASE_QUEUE) {
+        fprintf(stderr, "base: queue full\n");
+        return;
+    }
+    if (front) {
+        memmove(n->queue + 1, n->queue, n->queued * sizeof(command_t));
+        n->queue[0] = *c;
+    } else {
+        n->queue[n->queued] = *c;
+    }
+    n->queued++;
+}
+
+static uint8_t queuedDebug(const node_t *n, const command_t *c)
+{
+    for (uint8_t i = 0; i < n->queued; i++) {
+        if (n->queue[i].port == BASE_DEBUG_PORT && n->queue[i].value == c->value
+                && !memcmp(n->queue[i].data, c->data, BASE_DEBUG_DATA)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void printFrame(char kind, const command_t *c, uint64_t now, uint8_t more)
+{
+    uint8_t frame[TINY_UDP_FRAME_SIZE];
+    uint8_t size = TINY_UDP_HEADER_SIZE;
+    frame[0] = c->port;
+    frame[1] = 0;
+    memset(frame + size, 0, sizeof(frame) - size);
+    if (c->port == BASE_CONTROL_PORT) {
+        uint16_t bitmask = c->value | (more ? BASE_MORE : 0);
+        uint32_t timestamp = BASE_EPOCH + now / 1000000;
+        frame[2] = bitmask;
+        frame[3] = bitmask >> 8;
+        for (uint8_t i = 0; i < 4; i++) {
+            frame[4 + i] = timestamp >> (8 * i);
+        }
+        frame[8] = c->temperature;
+        frame[9] = c->temperature >> 8;
+        size += BASE_CONTROL_SIZE;
+    } else {
+        frame[2] = c->value;
+        frame[3] = c->value >> 8;
+        memcpy(frame + 4, c->data, BASE_DEBUG_DATA);
+        size += BASE_DEBUG_SIZE;
+    }
+    printf("%c %llu ", kind, (unsigned long long)c->queued);
+    for (uint8_t i = 0; i < size; i++) {
+        printf("%02x", frame[i]);
+    }
+    printf("\n");
+}
+
+/* Sends what is queued: the first control with the ACK, the rest into the listen window. Only controls
+ * can ask for the window (RADIO_CONTROL_MORE), so if none is queued a debug command goes with the ACK
+ * alone and the rest waits for the next report or poll. A one-shot slot past its end is not sent any more. */
+static void answer(node_t *n, uint64_t now)
+{
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < n->queued; i++) {
+        const command_t *c = &n->queue[i];
+        if (!(c->port == BASE_DEBUG_PORT && c->value == BASE_PROGRAM_SET && c->data[0] == BASE_ONCE_SLOT
+                    && now >= BASE_ONCE_END_US)) {
+            n->queue[kept++] = *c;
+        }
+    }
+    n->queued = kept;
+    uint8_t first = n->queued;
+    if (ack_payload) {
+        for (uint8_t i = 0; i < n->queued; i++) {
+            if (n->queue[i].port == BASE_CONTROL_PORT) {
+                first = i;
+                break;
+            }
+        }
+        if (first == n->queued && n->queued) {
+            printFrame('A', &n->queue[0], now, 0);
+            n->commands++;
+            n->queued--;
+            memmove(n->queue, n->queue + 1, n->queued * sizeof(command_t));
+            return;
+        }
+    }
+    if (first < n->queued) {
+        printFrame('A', &n->queue[first], now, n->queued > 1);
+    } else {
+        printf("A -\n");
+    }
+    for (uint8_t i = 0; i < n->queued; i++) {
+        if (i != first) {
+            printFrame('D', &n->queue[i], now, 0);
+        }
+    }
+    n->commands += n->queued;
+    n->queued = 0;
+}
+
+/* Decodes a value packet with the cached descriptors, returns 0 if they do not match its schema. */
+static uint8_t decode(node_t *n, uint8_t address, uint64_t now, const uint8_t *payload, uint8_t size)
+{
+    static const double Scales[] = { 1, 0.1, 0.01, 0.001 };
+    uint16_t crc = 0xFFFF;
+    uint16_t total = 0;
+    if (size < 2) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < n->descriptor_count; i++) {
+        const uint8_t *raw = (const uint8_t *)&n->descriptors[i];
+        for (uint8_t j = 0; j < sizeof(sensor_info); j++) {
+            crc = _crc_ccitt_update(crc, raw[j]);
+        }
+        if (n->descriptors[i].kind == sk_sensor) {
+            total += sizeOf(n->descriptors[i].size);
+        }
+    }
+    if (!n->descriptor_count || crc != (payload[size - 2] | payload[size - 1] << 8) || total != size) {
+        return 0;
+    }
+    if (!verbose) {
+        return 1;
+    }
+    fprintf(stderr, "%8.3f h %3u:", now / 3600e6, address);
+    for (uint8_t i = 0; i < n->descriptor_count; i++) {
+        const sensor_info *d = &n->descriptors[i];
+        if (d->kind != sk_sensor) {
+            continue;
+        }
+        uint8_t bytes = sizeOf(d->size);
+        uint32_t raw = 0;
+        for (uint8_t j = 0; j < bytes; j++) {
+            raw |= (uint32_t)payload[j] << (8 * j);
+        }
+        payload += bytes;
+        double value = raw;
+        if (d->size == ss_int8) {
+            value = (int8_t)raw;
+        } else if (d->size == ss_int16) {
+            value = (int16_t)raw;
+        } else if (d->size == ss_int32) {
+            value = (int32_t)raw;
+        }
+        fprintf(stderr, " %.*s=%.10g", SENSOR_NAME_SIZE, d->name, value * Scales[d->scale & 3]);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+}
+
+static void queueSlot(node_t *n, uint64_t now, uint8_t slot)
+{
+    command_t c = { now, BASE_DEBUG_PORT, BASE_PROGRAM_SET, 0, { slot } };
+    memcpy(c.data + 1, Program[slot], BASE_SLOT_SIZE);
+    queue(n, &c, 0);
+}
+
+/* Stores the program and the rest temperature, the one-shot slot only while it is ahead. */
+static void queueProgram(node_t *n, uint64_t now)
+{
+    command_t rest = { now, BASE_DEBUG_PORT, BASE_PROGRAM_REST, 0, { BASE_REST } };
+    queue(n, &rest, 0);
+    for (uint8_t i = 0; i < BASE_SLOTS; i++) {
+        if (Program[i][0] && (i != BASE_ONCE_SLOT || now < BASE_ONCE_END_US)) {
+            queueSlot(n, now, i);
+        }
+    }
+}
+
+/* Compares a slot as stored on the node with the program, sends it again if it differs. */
+static void programAnswer(node_t *n, uint8_t address, uint64_t now, const uint8_t *payload, uint8_t size)
+{
+    static const uint8_t Empty[BASE_SLOT_SIZE] = { 0 };
+    static const uint8_t Rest[BASE_SLOT_SIZE] = { 0, 0, 0, BASE_REST };
+    if (size != BASE_SLOT_SIZE + 1) {
+        return;
+    }
+    uint8_t slot = payload[BASE_SLOT_SIZE];
+    const uint8_t *expected = slot == BASE_PROGRAM_ALL ? Rest : slot < BASE_SLOTS ? Program[slot] : Empty;
+    n->slots++;
+    if (verbose) {
+        fprintf(stderr, "%8.3f h %3u: slot %3u: %02x %02x %02x %02x\n", now / 3600e6, address, slot, payload[0],
+                payload[1], payload[2], payload[3]);
+    }
+    if (slot == BASE_ONCE_SLOT) {
+        /* the node clears it at its end, the answer to its setting may come later */
+        uint8_t set = !memcmp(payload, expected, BASE_SLOT_SIZE);
+        uint8_t empty = !memcmp(payload, Empty, BASE_SLOT_SIZE);
+        if (now < BASE_ONCE_END_US) {
+            n->once_seen |= set;
+        } else if (empty) {
+            n->once_cleared = 1;
+        } else if (set && n->once_seen) {
+            n->once_stale = 1;
+            fprintf(stderr, "base: node %u: one-shot slot still set at %.3f h\n", address, now / 3600e6);
+        }
+        if (set || now >= BASE_ONCE_END_US) {
+            return;
+        }
+    }
+    if (memcmp(payload, expected, BASE_SLOT_SIZE)) {
+        n->slots_resent++;
+        if (slot == BASE_PROGRAM_ALL) {
+            command_t rest = { now, BASE_DEBUG_PORT, BASE_PROGRAM_REST, 0, { BASE_REST } };
+            queue(n, &rest, 0);
+        } else if (slot < BASE_SLOTS) {
+            queueSlot(n, now, slot);
+        }
+    }
+}
+
+/* Handles a complete packet, returns 1 if it was a report or a poll which gets the queued commands. */
+static uint8_t packet(node_t *n, uint8_t address, uint64_t now, uint8_t port, const uint8_t *payload, uint8_t size)
+{
+    if (port == SENSOR_INFO_PORT) {
+        if (n->fresh) {
+            n->fresh = 0;
+            n->descriptor_count = 0;
+        }
+        if (size == sizeof(sensor_info) && n->descriptor_count < BASE_DESCRIPTORS) {
+            memcpy(&n->descriptors[n->descriptor_count++], payload, sizeof(sensor_info));
+        }
+        return 0;
+    }
+    if (port == BASE_HISTORY_PORT) {
+        n->history += size;
+    }
+    if (port == BASE_PROGRAM_PORT) {
+        programAnswer(n, address, now, payload, size);
+        return 0;
+    }
+    if (port == BASE_POLL_PORT) {
+        n->polls++;
+    } else if (port != SENSOR_DATA_PORT) {
+        if (verbose) {
+            fprintf(stderr, "%8.3f h %3u: port %02x, %u bytes\n", now / 3600e6, address, port, size);
+        }
+        return 0;
+    } else {
+        n->fresh = 1;
+        n->reports++;
+        if (decode(n, address, now, payload, size)) {
+            n->decoded++;
+        } else {
+            n->unknown++;
+            command_t c = { now, BASE_DEBUG_PORT, BASE_DESCRIPTIONS, 0, { 0 } };
+            if (!queuedDebug(n, &c)) {
+                queue(n, &c, 0);
+            }
+        }
+    }
+    if (!n->seen || now - n->synced >= BASE_SYNC_US) {
+        command_t c = { now, BASE_CONTROL_PORT, BASE_SET_TIME, 0, { 0 } };
+        n->synced = now;
+        queue(n, &c, 0);
+    }
+    if (!n->seen) {
+        queueProgram(n, now);
+        n->next_program = now + program_period;
+    }
+    n->seen = 1;
+    while (now >= n->next_program) {
+        command_t c = { n->next_program, BASE_DEBUG_PORT, BASE_PROGRAM_GET, 0, { BASE_PROGRAM_ALL } };
+        queue(n, &c, 0);
+        n->next_program += program_period;
+    }
+    while (now >= n->next_temperature) {
+        n->high = !n->high;
+        command_t c = { n->next_temperature, BASE_CONTROL_PORT, BASE_SET_TEMPERATURE,
+            (int16_t)(n->high ? BASE_TEMPERATURE_HIGH : BASE_TEMPERATURE_LOW), { 0 } };
+        queue(n, &c, 0);
+        n->next_temperature += temperature_period;
+    }
+    while (now >= n->next_history) {
+        command_t c = { n->next_history, BASE_DEBUG_PORT, BASE_HISTORY, 0, { 0 } };
+        queue(n, &c, 0);
+        n->next_history += history_period;
+    }
+    return 1;
+}
+
+static uint8_t parseHex(const char *s, uint8_t *data)
+{
+    uint8_t size = 0;
+    unsigned byte;
+    while (size < TINY_UDP_FRAME_SIZE && sscanf(s, "%2x", &byte) == 1) {
+        data[size++] = byte;
+        s += 2;
+    }
+    return size;
+}
+
+/* U <us> <node> <hex>: reassembles the packet, answers every frame. */
+static void uplink(const char *line)
+{
+    unsigned long long now;
+    unsigned address;
+    int offset;
+    uint8_t frame[TINY_UDP_FRAME_SIZE];
+    if (sscanf(line, "U %llu %u %n", &now, &address, &offset) != 2 || address >= BASE_NODES) {
+        fprintf(stderr, "base: bad line %s", line);
+        exit(1);
+    }
+    node_t *n = &nodes[address];
+    uint8_t size = parseHex(line + offset, frame);
+    uint8_t report = 0;
+    if (size >= TINY_UDP_HEADER_SIZE) {
+        uint8_t chunk = size - TINY_UDP_HEADER_SIZE;
+        if (n->packet_size + chunk <= BASE_PACKET) {
+            memcpy(n->packet + n->packet_size, frame + TINY_UDP_HEADER_SIZE, chunk);
+            n->packet_size += chunk;
+        }
+        if (!(frame[1] & TINY_UDP_FRAGMENT)) {
+            report = packet(n, address, now, frame[0], n->packet, n->packet_size);
+            n->packet_size = 0;
+        }
+    }
+    if (report) {
+        answer(n, now);
+    } else {
+        printf("A -\n");
+    }
+    printf("E\n");
+    fflush(stdout);
+}
+
+/* L <queued> <node> <hex>: a listen window frame did not get through, it goes first next time. */
+static void missed(const char *line)
+{
+    unsigned long long queued;
+    unsigned address;
+    int offset;
+    uint8_t frame[TINY_UDP_FRAME_SIZE];
+    if (sscanf(line, "L %llu %u %n", &queued, &address, &offset) != 2 || address >= BASE_NODES) {
+        fprintf(stderr, "base: bad line %s", line);
+        exit(1);
+    }
+    uint8_t size = parseHex(line + offset, frame);
+    if (size < TINY_UDP_HEADER_SIZE + 2) {
+        return;
+    }
+    node_t *n = &nodes[address];
+    command_t c = { queued, frame[0], (uint16_t)((frame[2] | frame[3] << 8) & ~BASE_MORE), 0, { 0 } };
+    if (c.port == BASE_CONTROL_PORT && size >= TINY_UDP_HEADER_SIZE + BASE_CONTROL_SIZE) {
+        c.temperature = frame[8] | frame[9] << 8;
+    }
+    if (c.port == BASE_DEBUG_PORT && size >= TINY_UDP_HEADER_SIZE + BASE_DEBUG_SIZE) {
+        memcpy(c.data, frame + 4, BASE_DEBUG_DATA);
+    }
+    if (c.port == BASE_DEBUG_PORT && queuedDebug(n, &c)) {
+        return;
+    }
+    n->again++;
+    queue(n, &c, 1);
+}
+
+int main(int argc, char **argv)
+{
+    char line[BASE_LINE];
+    int option;
+    while ((option = getopt(argc, argv, "nvc:d:r:")) != -1) {
+        if (option == 'n') {
+            ack_payload = 0;
+        } else if (option == 'v') {
+            verbose = 1;
+        } else if (option == 'c') {
+            temperature_period = strtoull(optarg, NULL, 0) * 1000000;
+        } else if (option == 'd') {
+            history_period = strtoull(optarg, NULL, 0) * 1000000;
+        } else if (option == 'r') {
+            program_period = strtoull(optarg, NULL, 0) * 1000000;
+        } else {
+            fprintf(stderr, "usage: %s [-n] [-v] [-c seconds] [-d seconds] [-r seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+    for (unsigned i = 0; i < BASE_NODES; i++) {
+        nodes[i].next_temperature = temperature_period;
+        nodes[i].next_history = history_period;
+    }
+    while (fgets(line, sizeof(line), stdin)) {
+        if (line[0] == 'U') {
+            uplink(line);
+        } else if (line[0] == 'L') {
+            missed(line);
+        }
+    }
+    int failed = 0;
+    for (unsigned i = 0; i < BASE_NODES; i++) {
+        const node_t *n = &nodes[i];
+        if (!n->reports) {
+            continue;
+        }
+        /* the one-shot slot has to be gone once the program was read after its end */
+        uint8_t once_failed = n->once_stale || (n->once_seen && n->slots && !n->once_cleared);
+        if (verbose || !n->decoded || once_failed) {
+            fprintf(stderr, "base: node %u: %u reports, %u polls, %u decoded, %u unknown schema, %u descriptors, "
+                    "%u commands, %u again, %u history bytes, %u slots read, %u sent again, one-shot seen %u cleared %u\n", i,
+                    n->reports, n->polls, n->decoded, n->unknown, n->descriptor_count, n->commands, n->again, n->history,
+                    n->slots, n->slots_resent, n->once_seen, n->once_cleared);
+        }
+        if (!n->decoded || once_failed) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
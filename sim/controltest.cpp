@@ -0,0 +1,134 @@
+/* Host test of the fixed point controller.
+ *
+ * Includes control.cpp to reach sat16() and mac16(), the rest of the firmware comes from the host build
+ * (hal.cpp). Checks the saturating arithmetic at the int16 limits and the edge cases of control():
+ * the first run without history, the cap of long pauses to CONTROL_DT_MAX, the anti-windup at i_max and
+ * set-point steps, which must not act like a temperature change.
+ * Prints the failed checks and exits with 1 if there are any.
+ */
+#include <stdio.h>
+
+#include "../src/control.cpp"
+#include "sim.h"
+
+static unsigned checks, failures;
+
+static void check(const char *what, long value, long expected)
+{
+    checks++;
+    if (value != expected) {
+        failures++;
+        printf("FAIL %s: %ld, expected %ld\n", what, value, expected);
+    }
+}
+
+/* Sets the room so that the controller sees the error e (0.01 K). */
+static void setError(int16_t e)
+{
+    sim_ntc_celsius = 20.0;
+    updateNtcTemperature();
+    targetTemperature = getNtcTemperature() + e;
+}
+
+/*
+ * Runs control() at now, dt seconds after the last run (dt 0: first run), returns the I part.
+ * @param rise of the measured temperature since the last run (0.01 K)
+ */
+static int16_t runAfter(uint32_t now, uint32_t dt, int16_t e, int16_t rise, int16_t i_val)
+{
+    sim_seconds = now;
+    setError(e);
+    controller.t_last = dt ? now - dt : 0;
+    controller.temperature_last = getNtcTemperature() - rise;
+    controller.i_val = i_val;
+    control();
+    return controller.i_val;
+}
+
+static void testSaturation(void)
+{
+    check("sat16(32767)", sat16(32767), 32767);
+    check("sat16(32768)", sat16(32768), 32767);
+    check("sat16(-32768)", sat16(-32768), -32768);
+    check("sat16(-32769)", sat16(-32769), -32768);
+    check("sat16(INT32_MAX)", sat16(INT32_MAX), 32767);
+    check("sat16(INT32_MIN)", sat16(INT32_MIN), -32768);
+
+    check("mac16(100, 3, -7)", mac16(100, 3, -7), 79);
+    check("mac16(32767, 1, 1)", mac16(32767, 1, 1), 32767);
+    check("mac16(-32768, -1, 1)", mac16(-32768, -1, 1), -32768);
+    check("mac16(0, 32767, 32767)", mac16(0, 32767, 32767), 32767);
+    check("mac16(0, -32768, 32767)", mac16(0, -32768, 32767), -32768);
+    check("mac16(0, -32768, -32768)", mac16(0, -32768, -32768), 32767);
+    check("mac16(32767, -32768, 1)", mac16(32767, -32768, 1), -1);
+    check("mac16(32767, 32767, 32767)", mac16(32767, 32767, 32767), 32767);
+}
+
+static void testFirstRun(void)
+{
+    int16_t i_val = runAfter(1000, 0, 500, 0, -15000);
+    check("first run: I part unchanged", i_val, -15000);
+    check("first run: t_last", controller.t_last, 1000);
+    check("first run: temperature_last", controller.temperature_last, getNtcTemperature());
+}
+
+static void testPause(void)
+{
+    /* 1 K error, no D part: the I part grows by (k_i * e >> 4) per second */
+    int16_t per_second = (controller.k_i * 100) >> 4;
+    check("dt 600", runAfter(100000, CONTROL_DT_MAX, 100, 0, 0), per_second * CONTROL_DT_MAX);
+    check("dt 50000 capped", runAfter(100000, 50000, 100, 0, 0), per_second * CONTROL_DT_MAX);
+    check("dt 60", runAfter(100000, 60, 100, 0, 0), per_second * 60);
+    /* rtcGetSeconds() 0 is a valid time, but the controller takes t_last 0 as never run */
+    check("t_last 0 is the first run", runAfter(CONTROL_DT_MAX, CONTROL_DT_MAX, 100, 0, 0), 0);
+}
+
+static void testWindup(void)
+{
+    int16_t i_max = controller.i_max;
+    /* small error, output not saturated: the I part stops at +-i_max */
+    check("I part limited to i_max", runAfter(100000, CONTROL_DT_MAX, 40, 0, i_max - 100), i_max);
+    check("I part limited to -i_max", runAfter(100000, CONTROL_DT_MAX, -40, 0, 100 - i_max), -i_max);
+    int16_t i_val = 0;
+    for (uint32_t t = 1; t <= 100; t++) {
+        i_val = runAfter(100000 + t * 300, 300, 40, 0, i_val);
+    }
+    check("I part stays at i_max", i_val, i_max);
+
+    /* saturated output: no integration further into the limit, but out of it */
+    check("saturated high", runAfter(100000, 60, CONTROL_E_MAX, 0, 1000), 1000);
+    check("saturated low", runAfter(100000, 60, -CONTROL_E_MAX, 0, -1000), -1000);
+    /* the D part of a falling room saturates the output, the I part moves back from i_max */
+    check("unwinds from saturation", runAfter(100000, 1, -50, -1950, i_max) < i_max, 1);
+
+    /* errors beyond CONTROL_E_MAX and D steps across the whole range do not wrap around */
+    check("large error", runAfter(100000, 1, 30000, -30000, 0), 0);
+    check("large error: valve open", valveGetFlow(), 255);
+}
+
+static void testSetpointStep(void)
+{
+    /* 1 K step of the set-point with a flat room: P and I part only, slope 0 */
+    int16_t i_val = runAfter(100000, 60, 100, 0, 0);
+    int16_t per_second = (controller.k_i * 100) >> 4;
+    check("set-point step: I part", i_val, per_second * 60);
+    check("set-point step: no D kick", valveGetFlow(), 128 + ((controller.k_p * 100 + per_second * 60) >> 8));
+    check("set-point step: interval from the error", controlNextRun(), 100000 + controlInterval(100, 0));
+    /* the same error while the room falls by 0.3 K/min: D part and a shorter interval */
+    runAfter(100000, 60, 100, -30, 0);
+    check("falling room: interval from the slope", controlNextRun(), 100000 + controlInterval(100, -30));
+    check("falling room: shorter", controlInterval(100, -30) < controlInterval(100, 0), 1);
+}
+
+int main(void)
+{
+    simReset();
+    controlInit();
+    testSaturation();
+    testFirstRun();
+    testPause();
+    testWindup();
+    testSetpointStep();
+    printf("controltest: %u checks, %u failed\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,250 @@
+/* Simulated hardware: registers, ADC, EEPROM, SPI, motor, keys and debug output. The RTC is in hal_rtc.cpp. */
+#include <math.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "sim.h"
+#include "motor.h"
+#include "debug.h"
+#include "clock.h"
+#include "power.h"
+#include "config.h"
+#include "adc.h"
+#include "menu.h"
+
+volatile uint8_t PINA, PORTA, DDRA, PINB, PORTB, DDRB, PINC, PORTC, DDRC, PIND, PORTD, DDRD;
+volatile uint8_t PINE, PORTE, DDRE, PINF, DDRF, PING, PORTG, DDRG;
+sim_port_t PORTF;
+volatile uint8_t PRR, SREG, MCUCR, MCUSR, SMCR, CLKPR, OSCCAL, GPIOR0, GPIOR1, GPIOR2;
+volatile uint8_t ADMUX, ADCSRB, DIDR0, DIDR1;
+sim_adcsra_t ADCSRA;
+sim_adc_t ADC;
+volatile uint8_t EIMSK, EIFR, PCMSK0, PCMSK1;
+volatile uint8_t LCDCRA, LCDCRB, LCDFRR, LCDCCR;
+volatile uint8_t LCDDR0, LCDDR1, LCDDR2, LCDDR3, LCDDR4, LCDDR5, LCDDR6, LCDDR7, LCDDR8, LCDDR9;
+volatile uint8_t LCDDR10, LCDDR11, LCDDR12, LCDDR13, LCDDR14, LCDDR15, LCDDR16, LCDDR17, LCDDR18;
+volatile uint8_t SPCR, SPSR;
+sim_spdr_t SPDR;
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C, UDR0;
+volatile uint16_t UBRR0;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+volatile uint16_t TCNT1;
+volatile uint8_t TCCR2A, TCNT2, OCR2A, ASSR, TIMSK2, TIFR2;
+volatile uint8_t EECR, EEDR;
+volatile uint16_t EEAR;
+
+uint32_t sim_seconds;
+double sim_ntc_celsius;
+int16_t sim_motor_position;
+uint32_t sim_motor_counts;
+uint32_t sim_eeprom_writes;
+uint16_t sim_battery_mv = 3000;
+
+static int16_t sim_motor_contact_detected;
+
+/*************************************************************************
+ ****************************** ADC **************************************
+ *************************************************************************/
+/* 100 kOhm NTC, B = 3990 K, in the 10 Ohm units used by ntc.cpp */
+#define SIM_NTC_R25 10000.0
+#define SIM_NTC_B 3990.0
+/* Inverse of the voltage divider calculation in updateNtcTemperature(). */
+uint16_t simAdc(uint8_t channel)
+{
+    if (channel == ADC_CH_NTC) {
+        double r = SIM_NTC_R25 * exp(SIM_NTC_B * (1.0 / (sim_ntc_celsius + 273.15) - 1.0 / 298.15));
+        return (uint16_t)(102300000.0 / (1200000000.0 / r + 100000.0) + 0.5);
+    }
+    if (channel == 30) {
+        /* bandgap against the supply */
+        return 1100UL * 1024 / sim_battery_mv;
+    }
+    return 0;
+}
+
+sim_adc_t::operator uint16_t() const
+{
+    return simAdc(ADMUX & 0x1F);
+}
+
+/*************************************************************************
+ **************************** EEPROM *************************************
+ *************************************************************************/
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    return *addr;
+}
+
+uint16_t eeprom_read_word(const uint16_t *addr)
+{
+    return *addr;
+}
+
+uint32_t eeprom_read_dword(const uint32_t *addr)
+{
+    return *addr;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    *addr = value;
+    sim_eeprom_writes++;
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    if (*addr != value) {
+        eeprom_write_byte(addr, value);
+    }
+}
+
+void eeprom_update_word(uint16_t *addr, uint16_t value)
+{
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_update_dword(uint32_t *addr, uint32_t value)
+{
+    eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        eeprom_write_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+    }
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+    }
+}
+
+/*************************************************************************
+ ****************************** SPI **************************************
+ *************************************************************************/
+/* Nothing is connected unless the radio link emulator is linked in. */
+uint8_t (*sim_spi)(uint8_t mosi);
+void (*sim_port_hook)(uint8_t port);
+void (*sim_delay)(double us);
+
+sim_spdr_t &sim_spdr_t::operator=(uint8_t v)
+{
+    value = sim_spi ? sim_spi(v) : 0xFF;
+    SPSR |= 1 << SPIF;
+    return *this;
+}
+
+/*************************************************************************
+ ***************************** Motor *************************************
+ *************************************************************************/
+/* Moves are instantaneous, they take a few seconds on the real device. */
+void motorSetPosition(int16_t position)
+{
+    if (position < 0) position = 0;
+    if (position > SIM_MOTOR_MAX) position = SIM_MOTOR_MAX;
+    /* Closing past the valve seat detects it. */
+    if (position < SIM_MOTOR_CONTACT && sim_motor_position >= SIM_MOTOR_CONTACT) {
+        sim_motor_contact_detected = SIM_MOTOR_CONTACT;
+    }
+    sim_motor_counts += position > sim_motor_position ? position - sim_motor_position : sim_motor_position - position;
+    sim_motor_position = position;
+}
+
+int16_t motorGetPosition(void)
+{
+    return sim_motor_position;
+}
+
+int16_t motorGetMaxPosition(void)
+{
+    return SIM_MOTOR_MAX;
+}
+
+int16_t motorGetContactPosition(void)
+{
+    return sim_motor_contact_detected;
+}
+
+uint8_t motorIsAdapted(void)
+{
+    return 1;
+}
+
+/* Physical valve: closed below the seat, quick opening above it. */
+double simValveFlow(void)
+{
+    if (sim_motor_position <= SIM_MOTOR_CONTACT) {
+        return 0;
+    }
+    double x = (double)(sim_motor_position - SIM_MOTOR_CONTACT) / (SIM_MOTOR_MAX - SIM_MOTOR_CONTACT);
+    return 1 - (1 - x) * (1 - x) * (1 - x);
+}
+
+/*************************************************************************
+ ***************************** Power *************************************
+ *************************************************************************/
+/* power.cpp drives the hardware directly, this is its battery measurement. */
+uint16_t BatteryMV;
+
+uint16_t updateBattery(void)
+{
+    BatteryMV = 1100UL * 1024 / getAdc(30);
+    return BatteryMV;
+}
+
+uint8_t pwrAcquire(uint8_t block)
+{
+    uint8_t up = !!(PRR & (1 << block));
+    PRR &= ~(1 << block);
+    return up;
+}
+
+void pwrRelease(uint8_t block)
+{
+    PRR |= 1 << block;
+}
+
+/*************************************************************************
+ ***************************** Keys **************************************
+ *************************************************************************/
+/* No keys are pressed and there is no LCD to update. */
+void menu(void)
+{
+}
+
+/*************************************************************************
+ ***************************** Debug *************************************
+ *************************************************************************/
+void debugString(const char *)
+{
+}
+
+void debugNumber(int16_t)
+{
+}
+
+void debugBinary(uint16_t)
+{
+}
+
+void debugHex(uint16_t)
+{
+}
+
+void simReset(void)
+{
+    sim_seconds = 0;
+    sim_motor_position = SIM_MOTOR_MAX;
+    sim_motor_counts = 0;
+    sim_motor_contact_detected = 0;
+    sim_eeprom_writes = 0;
+}
@@ -0,0 +1,22 @@
+/* Simulated clock of the closed loop simulation: whole seconds, set by thermal.cpp. */
+#include "sim.h"
+#include "rtc.h"
+
+void rtcInit(void)
+{
+}
+
+uint32_t rtcGetSeconds(void)
+{
+    return sim_seconds;
+}
+
+/* The clock is always set, sim_seconds 0 is Monday 00:00. */
+void rtcSetWeekTime(uint32_t)
+{
+}
+
+uint32_t rtcGetWeekTime(void)
+{
+    return sim_seconds % RTC_WEEK_SECONDS;
+}
@@ -0,0 +1,587 @@
+/* Radio link emulator.
+ *
+ * An nRF24L01 on the SPI of the host build of radio.cpp: the registers radio.cpp accesses directly, the
+ * RX FIFO and the IRQ line, and the driver calls of nrf24l01.h and tinyudp.h. Frames go to a base station
+ * process (basestation.cpp) over pipes, one text line per frame:
+ *
+ *   node -> base  U <us> <node> <hex>       frame received by the base station (once, duplicates of a lost
+ *                                           ACK are dropped by its nRF24L01 as on the air)
+ *   base -> node  A - | A <queued> <hex>    its ACK, with payload: queued is the us the command was queued
+ *                 D <queued> <hex>          frames for the listen window (any number)
+ *                 E                         end of the answer
+ *   node -> base  L <queued> <node> <hex>   listen window frame given up, the base station queues it again
+ *
+ * Each frame and each ACK is lost to interference with the configured probability, and to noise depending on
+ * the link margin at the transmit power (RF_SETUP, the base station sends at 0 dBm). The sender retries
+ * after the auto retransmit delay up to NRF24L01_MAX_RETRIES times, OBSERVE_TX counts like on the chip.
+ * Listen window frames arrive latency_us after the report, they are received while the node listens
+ * (PRIM_RX, CE) and has room in the RX FIFO.
+ *
+ * The RTC counts the simulated time with an exact crystal, sysSleep() runs the time until the alarm or
+ * the IRQ line wakes the node.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <avr/io.h>
+
+#include "link.h"
+#include "radio.h"
+#include "nrf24l01.h"
+#include "tinyudp.h"
+#include "sensor.h"
+#include "rtc.h"
+#include "power.h"
+#include "clock.h"
+#include "config.h"
+
+/* nRF24L01 commands, registers and bits (datasheet) */
+#define LINK_R_REGISTER 0x00
+#define LINK_W_REGISTER 0x20
+#define LINK_REGISTER_MASK 0x1F
+#define LINK_CONFIG 0x00
+#define LINK_PRIM_RX 0
+#define LINK_PWR_UP 1
+#define LINK_EN_CRC 3
+#define LINK_RF_CH 0x05
+#define LINK_RF_SETUP 0x06
+#define LINK_RF_PWR 1 /* bits 2:1, 6 dB steps */
+#define LINK_RF_PWR_MAX 3
+#define LINK_STATUS 0x07
+#define LINK_OBSERVE_TX 0x08
+#define LINK_PLOS_CNT 4 /* bits 7:4 */
+#define LINK_PLOS_MAX 15
+#define LINK_ARC_CNT 0x0F /* bits 3:0 */
+#define LINK_RX_DR (1 << 6)
+#define LINK_TX_DS (1 << 5)
+#define LINK_MAX_RT (1 << 4)
+#define LINK_FLAGS (LINK_RX_DR | LINK_TX_DS | LINK_MAX_RT)
+#define LINK_RX_P_NO_EMPTY (7 << 1)
+#define LINK_RX_P_NO_1 (1 << 1)
+#define LINK_FIFO_STATUS 0x17
+#define LINK_FEATURE 0x1D
+#define LINK_EN_ACK_PAY 1
+#define LINK_EN_DPL 2
+#define LINK_RX_EMPTY 0
+#define LINK_RX_FULL 1
+#define LINK_TX_EMPTY 4
+
+/* One exchange is the frame at 1 Mbit/s, the turnaround and the ACK, as in tdma.cpp. */
+#define LINK_EXCHANGE_US 540
+#define LINK_ARD_US 500 /* auto retransmit delay */
+#define LINK_TX_US 330 /* 32 byte frame at 1 Mbit/s */
+#define LINK_STEP_DB 6.0 /* per RF_PWR step */
+#define LINK_SLOPE_DB 2.0 /* frame loss 1 / (1 + exp(margin / slope)) */
+#define LINK_RX_FIFO 3
+#define LINK_DOWNLINK 16 /* listen window frames on their way */
+#define LINK_SPI_IDLE 0xFF /* CSN high */
+#define LINK_LINE 256
+
+struct frame_t
+{
+    uint8_t size;
+    uint8_t data[TINY_UDP_FRAME_SIZE];
+};
+
+struct downlink_t
+{
+    uint64_t at; /* next attempt */
+    uint64_t queued;
+    uint8_t attempts;
+    frame_t frame;
+};
+
+uint64_t link_us;
+link_stats_t link_stats;
+
+volatile uint8_t pwr_wake_source = PWR_WAKE_NONE;
+uint16_t pwr_wakeups[PWR_WAKE_SOURCES];
+
+static FILE *link_to_base, *link_from_base;
+static double link_loss;
+static double link_margin_db;
+static uint32_t link_latency_us;
+static uint32_t link_rng;
+static uint8_t link_registers[LINK_REGISTER_MASK + 1];
+static frame_t link_rx[LINK_RX_FIFO];
+static uint8_t link_rx_count;
+static downlink_t link_downlink[LINK_DOWNLINK];
+static uint8_t link_downlink_count;
+static uint8_t link_ce;
+static uint8_t link_spi_command;
+static uint8_t link_spi_index = LINK_SPI_IDLE;
+static uint64_t link_on_since;
+static uint64_t link_wake_us;
+static uint32_t link_week_offset;
+static uint8_t link_week_set;
+
+/* Uniform in [0, 1), see tdma.cpp. */
+static double random01(void)
+{
+    link_rng ^= link_rng << 13;
+    link_rng ^= link_rng >> 17;
+    link_rng ^= link_rng << 5;
+    return (link_rng & 0xFFFFFF) / (double)0x1000000;
+}
+
+/* TX current per RF_PWR (nRF24L01+ datasheet) */
+static const double TxMilliamps[LINK_RF_PWR_MAX + 1] = { 7.0, 7.5, 9.0, 11.3 };
+
+/* Whether a frame sent at the given RF_PWR is lost. */
+static uint8_t lost(uint8_t power)
+{
+    double margin = link_margin_db - LINK_STEP_DB * (LINK_RF_PWR_MAX - power);
+    double noise = 1 / (1 + exp(margin / LINK_SLOPE_DB));
+    return random01() < 1 - (1 - link_loss) * (1 - noise);
+}
+
+static uint8_t txPower(void)
+{
+    return (link_registers[LINK_RF_SETUP] >> LINK_RF_PWR) & LINK_RF_PWR_MAX;
+}
+
+/*************************************************************************
+ *************************** nRF24L01 ************************************
+ *************************************************************************/
+static uint8_t powered(void)
+{
+    return link_registers[LINK_CONFIG] & (1 << LINK_PWR_UP);
+}
+
+static uint8_t listening(void)
+{
+    return powered() && (link_registers[LINK_CONFIG] & (1 << LINK_PRIM_RX)) && link_ce;
+}
+
+static void setConfig(uint8_t config)
+{
+    uint8_t was = powered();
+    link_registers[LINK_CONFIG] = config;
+    if (!was && powered()) {
+        link_on_since = link_us;
+    } else if (was && !powered()) {
+        link_stats.on_us += link_us - link_on_since;
+    }
+}
+
+/* The IRQ line goes low with the first flag, main.cpp calls Radio::irq() on that edge. */
+static void raise(uint8_t flags)
+{
+    uint8_t old = link_registers[LINK_STATUS] & LINK_FLAGS;
+    link_registers[LINK_STATUS] |= flags;
+    if (!old && (PCMSK0 & (1 << NRF24L01_PIN_IRQ))) {
+        Radio::irq();
+    }
+}
+
+static void clear(uint8_t flags)
+{
+    link_registers[LINK_STATUS] &= ~flags;
+}
+
+static uint8_t status(void)
+{
+    return (link_registers[LINK_STATUS] & LINK_FLAGS) | (link_rx_count ? LINK_RX_P_NO_1 : LINK_RX_P_NO_EMPTY);
+}
+
+static uint8_t readRegister(uint8_t reg)
+{
+    if (reg == LINK_STATUS) {
+        return status();
+    }
+    if (reg == LINK_FIFO_STATUS) {
+        return (link_rx_count ? 0 : 1 << LINK_RX_EMPTY) | (link_rx_count == LINK_RX_FIFO ? 1 << LINK_RX_FULL : 0)
+                | (1 << LINK_TX_EMPTY);
+    }
+    return link_registers[reg];
+}
+
+static void writeRegister(uint8_t reg, uint8_t value)
+{
+    if (reg == LINK_STATUS) {
+        clear(value & LINK_FLAGS);
+    } else if (reg == LINK_CONFIG) {
+        setConfig(value);
+    } else if (reg == LINK_RF_CH) {
+        link_registers[reg] = value;
+        link_registers[LINK_OBSERVE_TX] &= ~(LINK_PLOS_MAX << LINK_PLOS_CNT);
+    } else if (reg != LINK_FIFO_STATUS && reg != LINK_OBSERVE_TX) {
+        link_registers[reg] = value;
+    }
+}
+
+/* The first byte after CSN goes low is the command, the chip answers with STATUS meanwhile. */
+static uint8_t spi(uint8_t mosi)
+{
+    if (link_spi_index == LINK_SPI_IDLE) {
+        return 0xFF;
+    }
+    if (link_spi_index++ == 0) {
+        link_spi_command = mosi;
+        return status();
+    }
+    if (link_spi_command < LINK_W_REGISTER) {
+        return readRegister(link_spi_command & LINK_REGISTER_MASK);
+    }
+    if (link_spi_command < LINK_W_REGISTER + LINK_REGISTER_MASK + 1 && link_spi_index == 2) {
+        writeRegister(link_spi_command & LINK_REGISTER_MASK, mosi);
+    }
+    /* ACTIVATE is a no-op on the nRF24L01+, NOP has no data */
+    return 0;
+}
+
+static void portChanged(uint8_t port)
+{
+    if (port & (1 << NRF24L01_PIN_CSN)) {
+        link_spi_index = LINK_SPI_IDLE;
+    } else if (link_spi_index == LINK_SPI_IDLE) {
+        link_spi_index = 0;
+    }
+    link_ce = !!(port & (1 << NRF24L01_PIN_CE));
+}
+
+static uint8_t pushRx(const frame_t *frame)
+{
+    if (link_rx_count == LINK_RX_FIFO) {
+        return 0;
+    }
+    link_rx[link_rx_count++] = *frame;
+    raise(LINK_RX_DR);
+    return 1;
+}
+
+/*************************************************************************
+ ************************** Base station *********************************
+ *************************************************************************/
+static void printFrame(char kind, uint64_t queued, const frame_t *frame)
+{
+    fprintf(link_to_base, "%c %llu %u ", kind, (unsigned long long)queued, TINY_UDP_DEFAULT_IP);
+    for (uint8_t i = 0; i < frame->size; i++) {
+        fprintf(link_to_base, "%02x", frame->data[i]);
+    }
+    fputc('\n', link_to_base);
+    fflush(link_to_base);
+}
+
+/* Parses "<queued> <hex>" or "-", returns 0 for "-". */
+static uint8_t parseFrame(const char *s, uint64_t *queued, frame_t *frame)
+{
+    unsigned long long at;
+    int n;
+    frame->size = 0;
+    if (sscanf(s, "%llu %n", &at, &n) != 1) {
+        return 0;
+    }
+    *queued = at;
+    unsigned byte;
+    for (s += n; frame->size < TINY_UDP_FRAME_SIZE && sscanf(s, "%2x", &byte) == 1; s += 2) {
+        frame->data[frame->size++] = byte;
+    }
+    return frame->size > 0;
+}
+
+/* Hands a frame to the base station, returns its ACK payload in ack (size 0: none). */
+static void deliverUp(const frame_t *frame, uint64_t *queued, frame_t *ack)
+{
+    char line[LINK_LINE];
+    uint32_t window = 0;
+    ack->size = 0;
+    printFrame('U', link_us, frame);
+    while (fgets(line, sizeof(line), link_from_base)) {
+        if (line[0] == 'E') {
+            return;
+        }
+        if (line[0] == 'A') {
+            parseFrame(line + 2, queued, ack);
+        } else if (line[0] == 'D' && link_downlink_count < LINK_DOWNLINK) {
+            downlink_t *d = &link_downlink[link_downlink_count++];
+            d->attempts = 0;
+            d->at = link_us + LINK_EXCHANGE_US + link_latency_us + window++ * LINK_EXCHANGE_US;
+            parseFrame(line + 2, &d->queued, &d->frame);
+        }
+    }
+    fprintf(stderr, "link: base station closed the pipe\n");
+    exit(1);
+}
+
+static void received(uint64_t queued)
+{
+    double latency = link_us - queued;
+    link_stats.commands++;
+    link_stats.latency_sum += latency;
+    if (latency > link_stats.latency_max) {
+        link_stats.latency_max = latency;
+    }
+}
+
+/* One attempt of the base station to send a listen window frame, returns 1 when done with it. */
+static uint8_t deliverDown(downlink_t *d)
+{
+    if (!lost(LINK_RF_PWR_MAX) && listening() && pushRx(&d->frame)) {
+        received(d->queued);
+        return 1;
+    }
+    if (++d->attempts <= NRF24L01_MAX_RETRIES) {
+        d->at += LINK_EXCHANGE_US + LINK_ARD_US;
+        return 0;
+    }
+    link_stats.commands_missed++;
+    printFrame('L', d->queued, &d->frame);
+    return 1;
+}
+
+/* Runs the time until the given us, listen window frames arrive meanwhile. With stop, returns early
+ * when one of them woke the node. */
+static void advance(uint64_t until, uint8_t stop)
+{
+    for (;;) {
+        uint8_t next = LINK_DOWNLINK;
+        for (uint8_t i = 0; i < link_downlink_count; i++) {
+            if (link_downlink[i].at <= until && (next == LINK_DOWNLINK || link_downlink[i].at < link_downlink[next].at)) {
+                next = i;
+            }
+        }
+        if (next == LINK_DOWNLINK) {
+            break;
+        }
+        if (link_downlink[next].at > link_us) {
+            link_us = link_downlink[next].at;
+        }
+        if (deliverDown(&link_downlink[next])) {
+            link_downlink[next] = link_downlink[--link_downlink_count];
+        }
+        if (stop && pwr_wake_source != PWR_WAKE_NONE) {
+            return;
+        }
+    }
+    if (until > link_us) {
+        link_us = until;
+    }
+}
+
+/* Busy waits of the firmware, _delay_us() counts cycles of F_CPU. */
+static void delay(double us)
+{
+    advance(link_us + (uint64_t)(us / clockSpeedup()), 0);
+}
+
+void linkInit(FILE *to_base, FILE *from_base, double loss, double margin_db, uint32_t latency_us, uint32_t seed)
+{
+    link_to_base = to_base;
+    link_from_base = from_base;
+    link_loss = loss;
+    link_margin_db = margin_db;
+    link_latency_us = latency_us;
+    link_rng = seed ? seed : 1;
+    sim_spi = spi;
+    sim_port_hook = portChanged;
+    sim_delay = delay;
+    NRF24L01_PORT_CSN |= (1 << NRF24L01_PIN_CSN);
+}
+
+void linkFinish(void)
+{
+    if (powered()) {
+        link_stats.on_us += link_us - link_on_since;
+        link_on_since = link_us;
+    }
+    link_stats.power = txPower();
+}
+
+/*************************************************************************
+ ***************************** Driver ************************************
+ *************************************************************************/
+namespace NRF24L01 {
+
+uint8_t init(void)
+{
+    memset(link_registers, 0, sizeof(link_registers));
+    link_registers[LINK_CONFIG] = (1 << LINK_EN_CRC);
+    link_registers[LINK_STATUS] = LINK_RX_P_NO_EMPTY;
+    link_registers[LINK_RF_SETUP] = (LINK_RF_PWR_MAX << LINK_RF_PWR) | 1; /* 0 dBm, LNA */
+    link_rx_count = 0;
+    return 0;
+}
+
+void start_receive(void)
+{
+    setConfig(link_registers[LINK_CONFIG] | (1 << LINK_PWR_UP) | (1 << LINK_PRIM_RX));
+    NRF24L01_PORT_CE |= (1 << NRF24L01_PIN_CE);
+}
+
+}
+
+namespace TinyUDP {
+
+void init(void)
+{
+}
+
+/* Sends one frame like the driver: the flags are cleared once it has seen them. */
+static void transmit(const frame_t *frame)
+{
+    uint8_t delivered = 0;
+    uint64_t queued = 0;
+    frame_t ack;
+    ack.size = 0;
+    uint8_t observe = link_registers[LINK_OBSERVE_TX] & ~LINK_ARC_CNT;
+    link_stats.frames++;
+    for (uint8_t attempt = 0; attempt <= NRF24L01_MAX_RETRIES; attempt++) {
+        link_stats.attempts++;
+        link_stats.tx_uas += LINK_TX_US * TxMilliamps[txPower()] / 1000;
+        link_registers[LINK_OBSERVE_TX] = observe | attempt;
+        advance(link_us + LINK_EXCHANGE_US, 0);
+        if (!lost(txPower())) {
+            if (!delivered) {
+                delivered = 1;
+                deliverUp(frame, &queued, &ack);
+                if (ack.size && (~link_registers[LINK_FEATURE] & ((1 << LINK_EN_ACK_PAY) | (1 << LINK_EN_DPL)))) {
+                    /* the base station and the node disagree about ACK payloads */
+                    link_stats.misuse++;
+                    ack.size = 0;
+                }
+            }
+            if (!lost(LINK_RF_PWR_MAX)) {
+                link_stats.bytes += frame->size - TINY_UDP_HEADER_SIZE;
+                if (ack.size && pushRx(&ack)) {
+                    link_stats.ack_payloads++;
+                    received(queued);
+                }
+                raise(LINK_TX_DS);
+                clear(LINK_TX_DS);
+                return;
+            }
+        }
+        advance(link_us + LINK_ARD_US, 0);
+    }
+    link_stats.frames_lost++;
+    if ((observe >> LINK_PLOS_CNT) < LINK_PLOS_MAX) {
+        link_registers[LINK_OBSERVE_TX] += 1 << LINK_PLOS_CNT;
+    }
+    if (ack.size) {
+        link_stats.commands_lost++;
+    }
+    raise(LINK_MAX_RT);
+    clear(LINK_MAX_RT);
+}
+
+void send(Packet &packet, uint8_t size)
+{
+    const uint8_t *payload = (const uint8_t *)&packet + sizeof(Packet);
+    uint8_t n = size - sizeof(Packet);
+    if (!powered()) {
+        link_stats.misuse++;
+        return;
+    }
+    if (packet.port == SENSOR_DATA_PORT) {
+        link_stats.reports++;
+    }
+    setConfig(link_registers[LINK_CONFIG] & ~(1 << LINK_PRIM_RX));
+    do {
+        frame_t frame;
+        uint8_t chunk = n < TINY_UDP_FRAME_SIZE - TINY_UDP_HEADER_SIZE ? n : TINY_UDP_FRAME_SIZE - TINY_UDP_HEADER_SIZE;
+        n -= chunk;
+        frame.size = TINY_UDP_HEADER_SIZE + chunk;
+        frame.data[0] = packet.port;
+        frame.data[1] = packet.flags | (n ? TINY_UDP_FRAGMENT : 0);
+        memcpy(frame.data + TINY_UDP_HEADER_SIZE, payload, chunk);
+        payload += chunk;
+        transmit(&frame);
+    } while (n);
+    NRF24L01_PORT_CE &= ~(1 << NRF24L01_PIN_CE);
+}
+
+uint8_t receive(Packet &packet, uint8_t size)
+{
+    if (!link_rx_count) {
+        return 0;
+    }
+    frame_t frame = link_rx[0];
+    memmove(link_rx, link_rx + 1, --link_rx_count * sizeof(frame_t));
+    uint8_t n = frame.size - TINY_UDP_HEADER_SIZE;
+    packet.port = frame.data[0];
+    packet.flags = frame.data[1];
+    packet.set_payload_size(n);
+    if (n > size - sizeof(Packet)) {
+        n = size - sizeof(Packet);
+    }
+    memcpy((uint8_t *)&packet + sizeof(Packet), frame.data + TINY_UDP_HEADER_SIZE, n);
+    return 1;
+}
+
+}
+
+/*************************************************************************
+ ****************************** RTC **************************************
+ *************************************************************************/
+void rtcInit(void)
+{
+}
+
+uint32_t rtcGetSeconds(void)
+{
+    return link_us / 1000000;
+}
+
+uint32_t rtcGetTicks(void)
+{
+    return link_us * RTC_TICKS_PER_SECOND / 1000000;
+}
+
+void rtcWakeAt(uint32_t seconds)
+{
+    rtcWakeAtTick(seconds * RTC_TICKS_PER_SECOND);
+}
+
+void rtcWakeAtTick(uint32_t tick)
+{
+    link_wake_us = (uint64_t)tick * 1000000 / RTC_TICKS_PER_SECOND;
+}
+
+void rtcSetWeekTime(uint32_t seconds)
+{
+    link_week_offset = (seconds % RTC_WEEK_SECONDS + RTC_WEEK_SECONDS - rtcGetSeconds() % RTC_WEEK_SECONDS)
+            % RTC_WEEK_SECONDS;
+    link_week_set = 1;
+}
+
+uint32_t rtcGetWeekTime(void)
+{
+    if (!link_week_set) {
+        return RTC_NEVER;
+    }
+    return (rtcGetSeconds() + link_week_offset) % RTC_WEEK_SECONDS;
+}
+
+/* The crystal is exact, there is no drift to estimate. */
+void rtcSync(uint32_t seconds)
+{
+    rtcSetWeekTime(seconds);
+}
+
+int16_t rtcGetDrift(void)
+{
+    return 0;
+}
+
+/*************************************************************************
+ ***************************** Power *************************************
+ *************************************************************************/
+/* As in power.cpp: returns right away if the deadline passed or an IRQ came since the last return. */
+void sysSleep(uint32_t tick)
+{
+    rtcWakeAtTick(tick);
+    if (pwr_wake_source == PWR_WAKE_NONE && rtcGetTicks() < tick) {
+        advance(link_wake_us, 1);
+        if (pwr_wake_source == PWR_WAKE_NONE) {
+            pwr_wake_source = PWR_WAKE_ALARM;
+        }
+        pwr_wakeups[pwr_wake_source]++;
+    }
+    pwr_wake_source = PWR_WAKE_NONE;
+}
+
+void pwrDebugPrint(void)
+{
+}
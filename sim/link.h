@@ -0,0 +1,41 @@
+/* Interface between the radio link emulator (link.cpp) and the node program (radiolink.cpp). */
+#ifndef LINK_H_
+#define LINK_H_
+#include <stdint.h>
+#include <stdio.h>
+
+struct link_stats_t
+{
+    uint32_t reports; /* value packets */
+    uint32_t frames; /* uplink frames, each up to TINY_UDP_FRAME_SIZE */
+    uint32_t attempts; /* including retries */
+    uint32_t frames_lost; /* no ACK after all retries */
+    uint32_t bytes; /* payload bytes acknowledged */
+    uint32_t commands; /* frames from the base station received, as ACK payload or in a listen window */
+    uint32_t ack_payloads;
+    uint32_t commands_missed; /* listen window frames given up by the base station, it queues them again */
+    uint32_t commands_lost; /* ACK payloads of reports whose ACK was lost */
+    uint32_t misuse; /* frames sent while powered down, ACK payloads for a node without EN_ACK_PAY */
+    double latency_sum; /* us from queueing at the base station to the RX FIFO */
+    double latency_max;
+    uint64_t on_us; /* powered up (PWR_UP) */
+    double tx_uas; /* charge of the transmissions */
+    uint8_t power; /* RF_PWR at the end */
+};
+
+/* Simulated time in us since the start, the RTC counts it. */
+extern uint64_t link_us;
+extern link_stats_t link_stats;
+
+/**
+ * Connects the emulated nRF24L01 to the SPI of the firmware and to a base station.
+ * @param to_base, from_base pipes to basestation.cpp
+ * @param loss probability that a frame or its ACK is lost to interference
+ * @param margin_db of the link at 0 dBm over the sensitivity, less margin loses more frames
+ * @param latency_us from the report until the base station sends its listen window frames
+ */
+void linkInit(FILE *to_base, FILE *from_base, double loss, double margin_db, uint32_t latency_us, uint32_t seed);
+/* Closes the radio on time, notes the transmit power. */
+void linkFinish(void);
+
+#endif /* LINK_H_ */
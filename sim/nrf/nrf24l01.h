@@ -0,0 +1,14 @@
+/* Stand-in for the nRF24L01 driver submodule (src/nrf24l01/driver): the calls radio.cpp makes,
+ * implemented by the radio link emulator in link.cpp. */
+#ifndef SIM_NRF24L01_H_
+#define SIM_NRF24L01_H_
+#include <stdint.h>
+
+namespace NRF24L01 {
+/* Returns 0 if the module answers. */
+uint8_t init(void);
+/* Powers up in receive mode (PRIM_RX, CE high). */
+void start_receive(void);
+}
+
+#endif /* SIM_NRF24L01_H_ */
@@ -0,0 +1,57 @@
+/* Stand-in for the sensor submodule (src/nrf24l01/sensor): descriptors of the values a node sends and
+ * the controls it accepts. Descriptors go to SENSOR_INFO_PORT one per packet, values to SENSOR_DATA_PORT
+ * in the order of the descriptors. The layout is the stand-in's own, basestation.cpp decodes it. */
+#ifndef SIM_SENSOR_H_
+#define SIM_SENSOR_H_
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include "tinyudp.h"
+
+#define SENSOR_INFO_PORT 0x10
+#define SENSOR_DATA_PORT 0x11
+#define SENSOR_NAME_SIZE 11
+
+enum sensor_kind_t { sk_sensor, sk_control, sk_group };
+enum sensor_type_t { st_unixtime, st_seconds, st_temperature, st_raw, st_voltage };
+enum sensor_size_t { ss_uint8, ss_int8, ss_uint16, ss_int16, ss_uint32, ss_int32 };
+enum sensor_scale_t { sc_1, sc_0_1, sc_0_01, sc_0_001 };
+
+struct __attribute__((packed)) sensor_info
+{
+    uint8_t kind;
+    uint8_t id;
+    uint8_t type; /* sk_group: number of members */
+    uint8_t size;
+    uint8_t scale;
+    uint32_t min; /* sk_control */
+    uint32_t max;
+    char name[SENSOR_NAME_SIZE];
+};
+
+#define sinfo(id, type, size, scale, name) { sk_sensor, id, type, size, scale, 0, 0, name }
+#define cinfo(id, type, size, scale, min, max, name) { sk_control, id, type, size, scale, min, max, name }
+#define ginfo(id, n, name) { sk_group, id, n, 0, 0, 0, 0, name }
+
+struct sensor_info_packet : public TinyUDP::Packet
+{
+    sensor_info info;
+};
+
+static inline void send_sensor_info_P(const sensor_info *info)
+{
+    sensor_info_packet packet;
+    packet.port = SENSOR_INFO_PORT;
+    packet.flags = 0;
+    packet.set_payload_size(sizeof(sensor_info));
+    memcpy_P(&packet.info, info, sizeof(sensor_info));
+    TinyUDP::send(packet, sizeof(packet));
+}
+
+template <class T> void send_sensor_data(T &data)
+{
+    data.port = SENSOR_DATA_PORT;
+    TinyUDP::send(data, sizeof(T));
+}
+
+#endif /* SIM_SENSOR_H_ */
@@ -0,0 +1,31 @@
+/* Stand-in for TinyUDP (src/nrf24l01/driver), implemented by link.cpp.
+ * On the air a packet is port, flags and payload. Packets longer than a frame (TINY_UDP_FRAME_SIZE) are
+ * sent as several frames, all but the last with TINY_UDP_FRAGMENT. This framing is the stand-in's own,
+ * basestation.cpp reassembles it. */
+#ifndef SIM_TINYUDP_H_
+#define SIM_TINYUDP_H_
+#include <stdint.h>
+
+#define TINY_UDP_FRAME_SIZE 32 /* nRF24L01 payload */
+#define TINY_UDP_HEADER_SIZE 2 /* port, flags */
+#define TINY_UDP_FRAGMENT 0x80 /* flags: more frames of this packet follow */
+
+namespace TinyUDP {
+
+struct Packet
+{
+    uint8_t size; /* payload bytes, not sent */
+    uint8_t port;
+    uint8_t flags;
+    uint8_t payload_size() const { return size; }
+    void set_payload_size(uint8_t n) { size = n; }
+};
+
+void init(void);
+/* Takes the next frame from the RX FIFO, returns 0 if it is empty. size: of the packet including the header */
+uint8_t receive(Packet &packet, uint8_t size);
+/* Sends a packet of size bytes including the header, returns when it was acknowledged or given up. */
+void send(Packet &packet, uint8_t size);
+}
+
+#endif /* SIM_TINYUDP_H_ */
@@ -0,0 +1,194 @@
+/* Radio link benchmark.
+ *
+ * Runs the host build of the firmware with radio.cpp on the emulated nRF24L01 (link.cpp), connected to
+ * the base station program (basestation.cpp) over pipes. The room temperature follows a daily curve, the
+ * controller moves the valve, Radio::periodic() reports the changes and receives the commands of the base
+ * station: SetTime once a day and a set-point every three hours.
+ *
+ *   radiolink [scenario]                   all scenarios or one of them, simulated SIM_LINK_HOURS each
+ *   radiolink [-p loss%] [-m dB] [-l ms] [-v]
+ *                                          a custom link: loss of frames and ACKs to interference, link
+ *                                          margin at 0 dBm, base station latency, base station log on stderr
+ *
+ * Each scenario runs in its own process, so the firmware starts from a clean state. The scenarios without
+ * ACK payloads need the firmware built with RADIO_ACK_PAYLOAD 0 (radiolink-fixed), each build runs the
+ * scenarios which match it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+#include "link.h"
+#include "config.h"
+#include "ntc.h"
+#include "control.h"
+#include "valve.h"
+#include "motion.h"
+#include "preheat.h"
+#include "program.h"
+#include "store.h"
+#include "history.h"
+#include "radio.h"
+#include "rtc.h"
+#include "power.h"
+#include "clock.h"
+#include "loop.h"
+
+#define SIM_LINK_HOURS 24
+#define SIM_LINK_SEED 1
+
+struct scenario_t
+{
+    const char *name;
+    double loss; /* frames and ACKs, interference */
+    double margin_db; /* at 0 dBm, see link.cpp */
+    uint32_t latency_ms; /* base station, until its listen window frames */
+    uint8_t ack_payload;
+};
+
+static const scenario_t Scenarios[] = {
+    { "clean", 0, 40, 5, 1 },
+    { "lossy", 0.1, 40, 5, 1 },
+    { "bad", 0.3, 40, 5, 1 },
+    { "window", 0.1, 40, 5, 0 }, /* fixed payloads, all commands in the listen window */
+    { "slow", 0.1, 40, 200, 1 }, /* the base station answers after the window closed */
+    { "far", 0, 12, 5, 1 }, /* the transmit power matters */
+    { "edge", 0, 4, 5, 1 },
+};
+
+static char basestation[256];
+static uint8_t verbose;
+
+/* Starts the base station with its stdin and stdout on pipes. */
+static pid_t startBase(const scenario_t *s, FILE **to_base, FILE **from_base)
+{
+    int down[2], up[2];
+    if (pipe(down) || pipe(up)) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        const char *argv[4] = { basestation };
+        int argc = 1;
+        if (!s->ack_payload) {
+            argv[argc++] = "-n";
+        }
+        if (verbose) {
+            argv[argc++] = "-v";
+        }
+        argv[argc] = NULL;
+        dup2(up[0], 0);
+        dup2(down[1], 1);
+        close(up[1]);
+        close(down[0]);
+        execv(basestation, (char *const *)argv);
+        perror(basestation);
+        _exit(1);
+    }
+    close(up[0]);
+    close(down[1]);
+    *to_base = fdopen(up[1], "w");
+    *from_base = fdopen(down[0], "r");
+    return pid;
+}
+
+/* One pass of the main loop (loop.cpp) and its sleep, as in main(). */
+static void firmwareStep(void)
+{
+    loopPeriodic();
+    sysSleep(loopNextRun() * RTC_TICKS_PER_SECOND);
+}
+
+/* Returns 1 if no report got through, the firmware misused the radio or the base station failed. */
+static int run(const scenario_t *s)
+{
+    FILE *to_base, *from_base;
+    pid_t base = startBase(s, &to_base, &from_base);
+    simReset();
+    linkInit(to_base, from_base, s->loss, s->margin_db, s->latency_ms * 1000, SIM_LINK_SEED);
+    Radio::init();
+    valveInit();
+    controlInit();
+    preheatInit();
+    programInit();
+    storeInit();
+    historyInit();
+    while (rtcGetSeconds() < SIM_LINK_HOURS * 3600UL) {
+        sim_ntc_celsius = 20 - 2 * cos(2 * M_PI * rtcGetSeconds() / (24 * 3600.0));
+        firmwareStep();
+    }
+    linkFinish();
+    fclose(to_base);
+    fclose(from_base);
+    int status;
+    waitpid(base, &status, 0);
+
+    const link_stats_t *l = &link_stats;
+    printf("%-7s %5.0f %4.0f %5u %6u %6u %6.1f %5u %6.0f %5u %5u %5u %5u %7.2f %7.1f %6.2f %6.1f %3u\n", s->name,
+            s->loss * 100, s->margin_db, s->latency_ms, l->reports, l->frames,
+            l->frames ? 100.0 * (l->attempts - l->frames) / l->frames : 0.0, l->frames_lost,
+            l->bytes / (double)SIM_LINK_HOURS, l->commands, l->ack_payloads, l->commands_missed, l->commands_lost,
+            l->commands ? l->latency_sum / l->commands / 1e6 : 0.0, l->latency_max / 1e6, l->on_us / 1e6 / SIM_LINK_HOURS,
+            l->tx_uas / SIM_LINK_HOURS, l->power);
+    return !l->reports || l->misuse || !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+int main(int argc, char **argv)
+{
+    scenario_t custom = { "custom", 0, 40, 5, RADIO_ACK_PAYLOAD };
+    uint8_t custom_set = 0;
+    int option;
+    while ((option = getopt(argc, argv, "p:m:l:v")) != -1) {
+        if (option == 'p') {
+            custom.loss = atof(optarg) / 100;
+            custom_set = 1;
+        } else if (option == 'm') {
+            custom.margin_db = atof(optarg);
+            custom_set = 1;
+        } else if (option == 'l') {
+            custom.latency_ms = atoi(optarg);
+            custom_set = 1;
+        } else if (option == 'v') {
+            verbose = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-p loss%%] [-m dB] [-l ms] [-v] [scenario]\n", argv[0]);
+            return 2;
+        }
+    }
+    /* the base station is built next to this program */
+    const char *slash = strrchr(argv[0], '/');
+    snprintf(basestation, sizeof(basestation), "%.*sbasestation", slash ? (int)(slash - argv[0] + 1) : 2,
+            slash ? argv[0] : "./");
+
+    int failed = 0;
+    printf("%-7s %5s %4s %5s %6s %6s %6s %5s %6s %5s %5s %5s %5s %7s %7s %6s %6s %3s\n", "link", "loss", "marg", "lat",
+            "report", "frames", "retry", "lost", "bytes", "cmds", "ack", "miss", "clost", "cmdlat", "latmax", "radio", "tx",
+            "pwr");
+    printf("%-7s %5s %4s %5s %6s %6s %6s %5s %6s %5s %5s %5s %5s %7s %7s %6s %6s %3s\n", "", "%", "dB", "ms", "", "",
+            "%", "", "/h", "", "", "", "", "s", "s", "s/h", "uAs/h", "");
+    for (size_t i = 0; i <= sizeof(Scenarios) / sizeof(Scenarios[0]); i++) {
+        const scenario_t *s = i < sizeof(Scenarios) / sizeof(Scenarios[0]) ? &Scenarios[i] : &custom;
+        if (custom_set != (s == &custom) || (optind < argc && strcmp(argv[optind], s->name))
+                || s->ack_payload != RADIO_ACK_PAYLOAD) {
+            continue;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            int result = run(s);
+            fflush(stdout);
+            _exit(result);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            failed = 1;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,24 @@
+/* Interface between the simulated hardware (hal.cpp) and the room model (thermal.cpp). */
+#ifndef SIM_H_
+#define SIM_H_
+#include <stdint.h>
+
+/* Simulated seconds since start, returned by rtcGetSeconds(). */
+extern uint32_t sim_seconds;
+/* Temperature at the thermostat's NTC in degree Celsius. */
+extern double sim_ntc_celsius;
+
+/* Simulated valve drive */
+#define SIM_MOTOR_MAX 400
+#define SIM_MOTOR_CONTACT 80
+extern int16_t sim_motor_position;
+extern uint32_t sim_motor_counts;
+/* Battery voltage in mV, measured by updateBattery() */
+extern uint16_t sim_battery_mv;
+/* EEPROM bytes written */
+extern uint32_t sim_eeprom_writes;
+
+double simValveFlow(void);
+void simReset(void);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,177 @@
+/* Multi node radio channel simulation.
+ *
+ * Many thermostats report to one base station on the same channel. Compares reports on the uptime of each
+ * node (every RADIO_VALUES_S of its own crystal, random phase) with the slots of Radio::periodic(), where
+ * the slot follows from the address and the frame from the base station time.
+ *
+ * Each report is an nRF24L01 exchange (packet, turnaround, ACK). Exchanges which overlap at the base station
+ * are lost for both nodes, which retry after the auto retransmit delay until the retries are used up.
+ * After a report the base station sends a queued command in the listen window with TDMA_COMMAND_PERCENT.
+ * Reports are sent every frame, the worst case of report on change.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <queue>
+#include <vector>
+
+#include "config.h"
+
+#define TDMA_HOURS 24
+#define TDMA_FRAME_S (RADIO_SLOTS * RADIO_SLOT_S)
+#define TDMA_TX_US 330 /* 32 byte packet at 1 Mbit/s with preamble, address and CRC */
+#define TDMA_EXCHANGE_US 540 /* packet, 130 us turnaround, ACK */
+#define TDMA_ARD_US 500 /* auto retransmit delay */
+#define TDMA_ARC 15 /* auto retransmit count */
+#define TDMA_PPM 30 /* crystal error of free running nodes */
+#define TDMA_CLOCK_ERROR_US 1000000 /* clock error of slotted nodes, see rtcSync() */
+#define TDMA_COMMAND_PERCENT 5
+#define TDMA_COMMAND_US 5000 /* base station answers this long after the report */
+
+enum { EVENT_REPORT, EVENT_START, EVENT_END };
+
+struct event_t {
+    double t; /* us */
+    int type;
+    int node; /* nodes: base station sends its command as node -1 - receiver */
+    int attempt;
+    double first; /* start of the first attempt */
+    bool operator<(const event_t &e) const { return t > e.t; }
+};
+
+struct attempt_t {
+    int node;
+    int retries;
+    int collided;
+    double first;
+};
+
+struct stats_t {
+    unsigned reports, attempts, collisions, lost, commands, commands_lost;
+    double latency_sum, latency_max, airtime_us;
+};
+
+static uint32_t rng = 1;
+
+/* Uniform in [0, 1). */
+static double random01(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng & 0xFFFFFF) / (double)0x1000000;
+}
+
+static void run(int nodes, int slotted, stats_t *s)
+{
+    std::priority_queue<event_t> events;
+    std::vector<attempt_t> attempts;
+    std::vector<int> active;
+    std::vector<double> period(nodes);
+    double end = TDMA_HOURS * 3600e6;
+
+    memset(s, 0, sizeof(*s));
+    for (int n = 0; n < nodes; n++) {
+        int address = n + 1;
+        event_t e = { 0, EVENT_REPORT, n, 0, 0 };
+        if (slotted) {
+            period[n] = TDMA_FRAME_S * 1e6;
+            e.t = (address % RADIO_SLOTS) * RADIO_SLOT_S * 1e6 + TDMA_CLOCK_ERROR_US * (2 * random01() - 1);
+            if (e.t < 0) {
+                e.t += period[n];
+            }
+        } else {
+            period[n] = TDMA_FRAME_S * 1e6 * (1 + TDMA_PPM * 1e-6 * (2 * random01() - 1));
+            e.t = period[n] * random01();
+        }
+        events.push(e);
+    }
+
+    while (!events.empty() && events.top().t < end) {
+        event_t e = events.top();
+        events.pop();
+        if (e.type == EVENT_REPORT) {
+            event_t next = e;
+            next.t += period[e.node];
+            events.push(next);
+            s->reports++;
+            e.type = EVENT_START;
+            e.first = e.t;
+            e.attempt = -1;
+        }
+        if (e.type == EVENT_START) {
+            attempt_t a = { e.node, 0, 0, e.first };
+            if (e.attempt >= 0) {
+                a.retries = attempts[e.attempt].retries + 1;
+            }
+            e.attempt = attempts.size();
+            for (size_t i = 0; i < active.size(); i++) {
+                attempts[active[i]].collided = 1;
+                a.collided = 1;
+            }
+            attempts.push_back(a);
+            active.push_back(e.attempt);
+            if (e.node >= 0) {
+                s->attempts++;
+                s->airtime_us += TDMA_TX_US;
+            }
+            e.type = EVENT_END;
+            e.t += TDMA_EXCHANGE_US;
+            events.push(e);
+        } else if (e.type == EVENT_END) {
+            attempt_t a = attempts[e.attempt];
+            for (size_t i = 0; i < active.size(); i++) {
+                if (active[i] == e.attempt) {
+                    active.erase(active.begin() + i);
+                    break;
+                }
+            }
+            if (a.collided) {
+                if (a.node >= 0) {
+                    s->collisions++;
+                }
+                if (a.retries < TDMA_ARC) {
+                    e.type = EVENT_START;
+                    e.t += TDMA_ARD_US;
+                    events.push(e);
+                } else if (a.node >= 0) {
+                    s->lost++;
+                } else {
+                    s->commands_lost++;
+                }
+            } else if (a.node >= 0) {
+                double latency = e.t - a.first;
+                s->latency_sum += latency;
+                if (latency > s->latency_max) {
+                    s->latency_max = latency;
+                }
+                if (random01() * 100 < TDMA_COMMAND_PERCENT) {
+                    event_t c = { e.t + TDMA_COMMAND_US, EVENT_START, -1 - a.node, -1, e.t + TDMA_COMMAND_US };
+                    events.push(c);
+                    s->commands++;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const int Nodes[] = { 5, 10, 20, 30, 45, 60, 90 };
+    printf("%-7s %5s %8s %7s %6s %8s %8s %7s %7s\n", "scheme", "nodes", "reports", "coll%", "lost", "lat", "latmax",
+            "air", "cmdlost");
+    printf("%-7s %5s %8s %7s %6s %8s %8s %7s %7s\n", "", "", "", "", "", "ms", "ms", "ms/h", "");
+    for (int slotted = 0; slotted < 2; slotted++) {
+        for (size_t i = 0; i < sizeof(Nodes) / sizeof(Nodes[0]); i++) {
+            stats_t s;
+            run(Nodes[i], slotted, &s);
+            unsigned delivered = s.reports - s.lost;
+            printf("%-7s %5d %8u %7.3f %6u %8.2f %8.2f %7.1f %3u/%-3u\n", slotted ? "slotted" : "uptime", Nodes[i],
+                    s.reports, s.attempts ? 100.0 * s.collisions / s.attempts : 0.0, s.lost,
+                    delivered ? s.latency_sum / delivered / 1000 : 0.0, s.latency_max / 1000,
+                    s.airtime_us / 1000 / Nodes[i] / TDMA_HOURS, s.commands_lost, s.commands);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,416 @@
+/* Closed loop room simulation.
+ *
+ * Runs the firmware's control path (NTC conversion, controller, valve curve, motion policy)
+ * against a lumped thermal model of a room with one radiator:
+ *
+ *   radiator:  C_r dT_r/dt = flow * G_w (T_supply - T_r) - G_r (T_r - T_a)
+ *   room air:  C_a dT_a/dt = G_r (T_r - T_a) - G_m (T_a - T_m) - (G_l + window * G_win) (T_a - T_o)
+ *   walls etc: C_m dT_m/dt = G_m (T_a - T_m) + sun
+ *
+ * The air reacts within minutes (open windows), the building mass within hours.
+ * The thermostat sits at the radiator, so its NTC sees a mix of air and radiator temperature.
+ * Each scenario runs in its own process, so the firmware starts from a clean state.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sim.h"
+#include "config.h"
+#include "ntc.h"
+#include "control.h"
+#include "valve.h"
+#include "motion.h"
+#include "motor.h"
+#include "autotune.h"
+#include "preheat.h"
+#include "program.h"
+#include "store.h"
+#include "history.h"
+#include "clock.h"
+#include "rtc.h"
+#include "radio.h"
+#include "loop.h"
+
+#define DAY (24UL * 3600)
+#define HOUR 3600UL
+
+/* Model parameters */
+#define T_SUPPLY 60.0 /* degC */
+#define G_WATER 150.0 /* W/K, fully open valve */
+#define G_RADIATOR 70.0 /* W/K */
+#define G_LOSS 50.0 /* W/K */
+#define G_WINDOW 400.0 /* W/K, open window */
+#define G_MASS 300.0 /* W/K, air to walls and furniture */
+#define C_RADIATOR 150e3 /* J/K */
+#define C_AIR 100e3 /* J/K */
+#define C_MASS 1.4e6 /* J/K */
+#define NTC_COUPLING 0.0 /* share of radiator temperature seen by the NTC, > 0 models a biased sensor */
+
+/* Comfort metrics */
+#define BAND 0.3 /* K, settled when within this band */
+#define SETTLED_HOLD (30 * 60) /* s, has to stay within the band this long */
+
+/* Optimum start variants */
+#define PREHEAT_NONE 0
+#define PREHEAT_FIXED 1 /* raise the setpoint PREHEAT_FIXED_LEAD early */
+#define PREHEAT_OPTIMUM 2 /* preheat.cpp */
+#define PREHEAT_PROGRAM 3 /* setpoints and preheat from the weekly program in program.cpp */
+#define PREHEAT_FIXED_LEAD (2 * HOUR)
+
+struct scenario_t
+{
+    const char *name;
+    uint32_t duration;
+    double (*setpoint)(uint32_t t); /* degC */
+    double (*outside)(uint32_t t); /* degC */
+    uint8_t (*window)(uint32_t t);
+    double (*sun)(uint32_t t); /* W */
+    uint8_t autotune; /* run autotune at constant 21 degC first */
+    uint8_t preheat;
+};
+
+/* Time 0 is Monday, 00:00. */
+static uint32_t timeOfDay(uint32_t t)
+{
+    return t % DAY;
+}
+
+static double constant21(uint32_t)
+{
+    return 21.0;
+}
+
+/* 21 degC from 6:00 to 22:00, 17 degC at night */
+static double setback(uint32_t t)
+{
+    uint32_t tod = timeOfDay(t);
+    return (tod >= 6 * HOUR && tod < 22 * HOUR) ? 21.0 : 17.0;
+}
+
+static double outsideCold(uint32_t)
+{
+    return 0.0;
+}
+
+/* 0 degC at 4:00, 8 degC at 16:00 */
+static double outsideDaily(uint32_t t)
+{
+    return 4.0 - 4.0 * cos(2 * M_PI * ((double)timeOfDay(t) - 4 * HOUR) / DAY);
+}
+
+static uint8_t windowClosed(uint32_t)
+{
+    return 0;
+}
+
+/* Airing for 15 minutes at 7:00 and 18:00 */
+static uint8_t windowTwiceDaily(uint32_t t)
+{
+    uint32_t tod = timeOfDay(t);
+    return (tod >= 7 * HOUR && tod < 7 * HOUR + 900) || (tod >= 18 * HOUR && tod < 18 * HOUR + 900);
+}
+
+static double noSun(uint32_t)
+{
+    return 0;
+}
+
+/* Up to 600 W through a south window between 10:00 and 16:00 */
+static double sunny(uint32_t t)
+{
+    uint32_t tod = timeOfDay(t);
+    if (tod < 10 * HOUR || tod >= 16 * HOUR) {
+        return 0;
+    }
+    return 600.0 * sin(M_PI * (tod - 10 * HOUR) / (6 * HOUR));
+}
+
+static const scenario_t Scenarios[] = {
+    { "steady", 2 * DAY, constant21, outsideCold, windowClosed, noSun, 0, PREHEAT_NONE },
+    { "setback", 7 * DAY, setback, outsideDaily, windowClosed, noSun, 0, PREHEAT_NONE },
+    { "window", 7 * DAY, setback, outsideDaily, windowTwiceDaily, noSun, 0, PREHEAT_NONE },
+    { "sun", 7 * DAY, setback, outsideDaily, windowClosed, sunny, 0, PREHEAT_NONE },
+    { "tuned", 7 * DAY, setback, outsideDaily, windowClosed, noSun, 1, PREHEAT_NONE },
+    { "prefixed", 7 * DAY, setback, outsideDaily, windowClosed, noSun, 0, PREHEAT_FIXED },
+    { "preopt", 7 * DAY, setback, outsideDaily, windowClosed, noSun, 0, PREHEAT_OPTIMUM },
+    { "program", 7 * DAY, setback, outsideDaily, windowClosed, noSun, 0, PREHEAT_PROGRAM },
+};
+
+struct metrics_t
+{
+    double overshoot; /* K, largest excursion above the setpoint after a rise */
+    double settling_sum; /* s */
+    uint32_t settled; /* number of setpoint rises which settled */
+    uint32_t rises;
+    double abs_error_sum; /* K*s */
+    double cold_sum; /* K*s more than BAND below the setpoint */
+    double heat; /* J */
+    uint32_t wakeups;
+    uint32_t packets;
+    double radio_ms; /* radio powered up */
+};
+
+struct room_t
+{
+    double t_room; /* air */
+    double t_rad;
+    double t_mass;
+};
+
+/* One second of the thermal model, returns the heat given to the room in J. */
+static double roomStep(room_t *r, double outside, uint8_t window, double sun)
+{
+    double q_water = simValveFlow() * G_WATER * (T_SUPPLY - r->t_rad);
+    double q_rad = G_RADIATOR * (r->t_rad - r->t_room);
+    double q_mass = G_MASS * (r->t_room - r->t_mass);
+    double g_out = G_LOSS + (window ? G_WINDOW : 0);
+    r->t_rad += (q_water - q_rad) / C_RADIATOR;
+    r->t_room += (q_rad - q_mass - g_out * (r->t_room - outside)) / C_AIR;
+    r->t_mass += (q_mass + sun) / C_MASS;
+    return q_rad;
+}
+
+/* Number of control() runs */
+static uint32_t control_runs;
+
+/* Stand-in for Radio::periodic(): values are checked every 60 s and sent on a change of temperature or valve
+ * position (battery, window and preheat fields are not simulated) or after RADIO_HEARTBEAT_S, the 24
+ * descriptors once after boot (the base station caches them). Each report is followed by a listen window.
+ * Radio on time as counted by radio.cpp: 2 ms power up, 1 ms per packet. radiolink runs the real driver. */
+#define SIM_RADIO_VALUES_S 60
+#define SIM_RADIO_DESCRIPTIONS 24
+static uint32_t radio_next_values, radio_next_heartbeat;
+static uint8_t radio_described;
+static int16_t radio_temperature, radio_valve; /* last reported */
+static uint32_t radio_packets; /* sent by the last Radio::periodic() */
+
+void Radio::periodic(void)
+{
+    uint32_t now = rtcGetSeconds();
+    radio_packets = 0;
+    if (now < radio_next_values) {
+        return;
+    }
+    radio_next_values = now + SIM_RADIO_VALUES_S;
+    if (abs(getNtcTemperature() - radio_temperature) < RADIO_DELTA_TEMPERATURE
+            && abs(motorGetPosition() - radio_valve) < RADIO_DELTA_VALVE && now < radio_next_heartbeat) {
+        return;
+    }
+    radio_next_heartbeat = now + RADIO_HEARTBEAT_S;
+    radio_temperature = getNtcTemperature();
+    radio_valve = motorGetPosition();
+    if (!radio_described) {
+        radio_described = 1;
+        radio_packets += SIM_RADIO_DESCRIPTIONS;
+    }
+    radio_packets++;
+}
+
+uint32_t Radio::nextRun(void)
+{
+    return radio_next_values;
+}
+
+/* Runs one pass of the main loop (loop.cpp), returns the number of radio packets sent. */
+static uint32_t firmwareStep(const room_t *r)
+{
+    sim_ntc_celsius = r->t_room + NTC_COUPLING * (r->t_rad - r->t_room);
+    /* control() always moves its next run, also after a setpoint change reset it to 0 */
+    uint32_t control_next = controlNextRun();
+    loopPeriodic();
+    if (controlNextRun() != control_next) {
+        control_runs++;
+    }
+    return radio_packets;
+}
+
+/* Finds the next setpoint rise within a day after t. Returns 0 if there is none. */
+static uint32_t nextRise(const scenario_t *s, uint32_t t, double *temperature)
+{
+    double sp = s->setpoint(t);
+    for (uint32_t at = t + 450; at < t + DAY; at += 450) {
+        if (s->setpoint(at) > sp) {
+            *temperature = s->setpoint(at);
+            return at;
+        }
+        sp = s->setpoint(at);
+    }
+    return 0;
+}
+
+/* Returns 1 if the power loss budget is exceeded. */
+static int run(const scenario_t *s)
+{
+    metrics_t m;
+    memset(&m, 0, sizeof(m));
+    simReset();
+    valveInit();
+    controlInit();
+    preheatInit();
+    programInit();
+    storeInit();
+    historyInit();
+    if (s->preheat == PREHEAT_PROGRAM) {
+        /* same as setback() */
+        const program_t day = { PROGRAM_DAYS, PROGRAM_TIME(6, 0), PROGRAM_TIME(22, 0), 21 * 4 };
+        programSet(0, &day);
+        programSetRest(17 * 4);
+    }
+
+    room_t room = { s->setpoint(0), s->setpoint(0) + 12, s->setpoint(0) };
+
+    if (s->autotune) {
+        room.t_room = room.t_rad = room.t_mass = 15.0;
+        setNominalTemperature(2100);
+        autotuneStart();
+        while (autotuneActive()) {
+            sim_seconds++;
+            if (sim_seconds >= loopNextRun()) {
+                firmwareStep(&room);
+            }
+            roomStep(&room, outsideCold(0), 0, 0);
+        }
+        fprintf(stderr, "%s: autotune %u after %.1f h: k_p %d k_i %d k_d %d\n", s->name, autotune_state,
+                sim_seconds / 3600.0, controller.k_p, controller.k_i, controller.k_d);
+    }
+
+    uint32_t start = sim_seconds;
+    uint32_t counts_start = sim_motor_counts;
+    uint32_t eeprom_start = sim_eeprom_writes;
+    uint32_t control_start = control_runs;
+    motion_stats_t motion_start = motion_stats;
+    double sp_last = s->setpoint(0);
+    int32_t rise_start = -1; /* time of the last setpoint rise, -1: none pending */
+    int32_t band_enter = -1;
+    uint8_t rising = 0;
+    uint8_t schedule = 1;
+
+    setNominalTemperature((int16_t)(sp_last * 100));
+    for (uint32_t t = 1; t <= s->duration; t++) {
+        sim_seconds = start + t;
+
+        /* Setpoint schedule, applied on changes only */
+        double sp = s->setpoint(t);
+        if (sp != sp_last) {
+            if (s->preheat != PREHEAT_PROGRAM) {
+                setNominalTemperature((int16_t)(sp * 100));
+            }
+            if (sp > sp_last) {
+                m.rises++;
+                rise_start = t;
+                band_enter = -1;
+                rising = 1;
+            } else {
+                rise_start = -1;
+                rising = 0;
+            }
+            schedule = 1;
+        }
+        sp_last = sp;
+        double next_sp;
+        if (s->preheat == PREHEAT_FIXED && s->setpoint(t + PREHEAT_FIXED_LEAD) > sp) {
+            setNominalTemperature((int16_t)(s->setpoint(t + PREHEAT_FIXED_LEAD) * 100));
+        } else if (s->preheat == PREHEAT_OPTIMUM && schedule) {
+            uint32_t at = nextRise(s, t, &next_sp);
+            if (at) {
+                preheatSchedule(start + at, (int16_t)(next_sp * 100));
+            }
+        }
+        schedule = 0;
+
+        if (sim_seconds >= loopNextRun()) {
+            uint32_t packets = firmwareStep(&room);
+            if (packets) {
+                m.packets += packets;
+                m.radio_ms += 2 + packets + RADIO_LISTEN_MS;
+            }
+            m.wakeups++;
+        }
+        m.heat += roomStep(&room, s->outside(t), s->window(t), s->sun(t));
+
+        /* Comfort */
+        double err = room.t_room - sp;
+        m.abs_error_sum += fabs(err);
+        if (err < -BAND) {
+            m.cold_sum += -err - BAND;
+        }
+        if (rising && err > m.overshoot) {
+            m.overshoot = err;
+        }
+        if (rise_start >= 0) {
+            if (fabs(err) <= BAND) {
+                if (band_enter < 0) {
+                    band_enter = t;
+                } else if (t - band_enter >= SETTLED_HOLD) {
+                    m.settling_sum += band_enter - rise_start;
+                    m.settled++;
+                    rise_start = -1;
+                }
+            } else {
+                band_enter = -1;
+            }
+        }
+    }
+
+    uint32_t eeprom_writes = sim_eeprom_writes - eeprom_start;
+    /* Power loss at the end: the shutdown record has to be written within the hold-up time. */
+    uint32_t writes = sim_eeprom_writes;
+    storeShutdownStart();
+    while (storeShutdownStep())
+        ;
+    uint32_t shutdown_us = (sim_eeprom_writes - writes) * EEPROM_WRITE_US;
+
+    double hours = s->duration / 3600.0;
+    printf("%-10s %5.0f %6.2f %7.1f %3u/%-3u %6.2f %7.2f %7.2f %7u %6u %6u %8u %6u %8u %6.1f %6u %6.1f\n", s->name, hours,
+            m.overshoot, m.settled ? m.settling_sum / m.settled / 60 : 0.0, m.settled, m.rises,
+            m.abs_error_sum / s->duration, m.cold_sum / 3600, m.heat / 3.6e6, (unsigned)(sim_motor_counts - counts_start),
+            motion_stats.executed - motion_start.executed, motion_stats.suppressed - motion_start.suppressed, m.wakeups,
+            control_runs - control_start, m.packets, m.radio_ms / hours / 1000, eeprom_writes, shutdown_us / 1000.0);
+    if (s->preheat == PREHEAT_OPTIMUM || s->preheat == PREHEAT_PROGRAM) {
+        fprintf(stderr, "%s: last preheat arrival error %d min, lead for 4 K now %u min\n", s->name, preheat_error,
+                preheatLeadTime(1700, 2100));
+    }
+    if (shutdown_us > POWERLOSS_BUDGET_US) {
+        fprintf(stderr, "%s: shutdown save takes %u us, budget %u us\n", s->name, shutdown_us, POWERLOSS_BUDGET_US);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    printf("%-10s %5s %6s %7s %7s %6s %7s %7s %7s %6s %6s %8s %6s %8s %6s %6s %6s\n", "scenario", "hours",
+            "over", "settle", "settled", "|err|", "coldKh", "kWh", "counts", "moves", "supp", "wakeups", "ctrl", "packets",
+            "radio", "eewr", "down");
+    printf("%-10s %5s %6s %7s %7s %6s %7s %7s %7s %6s %6s %8s %6s %8s %6s %6s %6s\n", "", "", "K", "min", "", "K", "", "",
+            "", "", "", "", "", "", "s/h", "", "ms");
+    for (size_t i = 0; i < sizeof(Scenarios) / sizeof(Scenarios[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], Scenarios[i].name)) {
+            continue;
+        }
+        fflush(stdout);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pid_t pid = fork();
+        if (pid == 0) {
+            int result = run(&Scenarios[i]);
+            fflush(stdout);
+            _exit(result);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            failed = 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "%s: %.2f s\n", Scenarios[i].name,
+                end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+    return failed;
+}
@@ -0,0 +1,6 @@
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 0
+#define ATOMIC_BLOCK(type) for (uint8_t sim_atomic_once = 1; sim_atomic_once; sim_atomic_once = 0)
+#endif
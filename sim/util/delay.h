@@ -0,0 +1,7 @@
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+/* Busy waits take no time unless the simulation counts them (sim_delay, see link.cpp). */
+extern void (*sim_delay)(double us);
+static inline void _delay_ms(double ms) { if (sim_delay) sim_delay(ms * 1000); }
+static inline void _delay_us(double us) { if (sim_delay) sim_delay(us); }
+#endif
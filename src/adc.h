@@ -3,19 +3,29 @@
 
 #include <avr/io.h>
 #include <util/delay.h>
+#include "clock.h"
+#include "power.h"
 
 static inline uint16_t getAdc(uint8_t channel)
 {
     /* Use AVCC as voltage reference. Result is right-aligned. Prescaler: 16 => 62500kHz.
      * First conversation: 25 cycles => 400us
      * Normal conversation: 13 cycles => 200us
+     * The conversion is waited for at F_CPU, a faster clock would only burn power (see clock.cpp).
      * */
+    uint8_t div = clock_div;
+    clockSlow();
+    pwrAcquire(PRADC);
     ADMUX = (1 << REFS0) | (channel & 0x1F);
     _delay_us(0.5);
     ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADPS2);
     while (ADCSRA & (1 << ADSC))
         ;
-    return ADC;
+    uint16_t result = ADC;
+    ADCSRA = 0; /* must be disabled before it is powered down */
+    pwrRelease(PRADC);
+    clockSet(div);
+    return result;
 }
 
 extern uint16_t BatteryMV;
@@ -0,0 +1,156 @@
+#include "autotune.h"
+#include "control.h"
+#include "ntc.h"
+#include "rtc.h"
+#include "valve.h"
+#include "debug.h"
+
+/* Relay feedback experiment (Astrom-Hagglund)
+ *
+ * The valve is switched fully open when the temperature drops below setpoint - AUTOTUNE_HYSTERESIS
+ * and closed when it exceeds setpoint + AUTOTUNE_HYSTERESIS. The room settles into a limit cycle
+ * with period Tu and amplitude a. The ultimate gain follows from the relay amplitude d:
+ *   Ku = 4 d / (pi a)
+ * The cycle is that of the fast loop valve - radiator - NTC (Tu ~ 20 min in the simulation), which
+ * tolerates a high gain. Rules for that loop (Tyreus-Luyben: Kp = Ku / 3.2, Ti = 2.2 Tu) move the
+ * valve at every 0.1 K and leave the slow part (walls, outside) to an I part that needs hours.
+ * In the sim's "tuned" room they gave k_p 686 and k_i 5 and twice the valve moves of the defaults.
+ * A low gain with a short integral time suits the battery better:
+ *   Kp = Ku / 16, Ti = Tu / 2
+ * k_p 80..150 with k_i 3..6 all beat the defaults there, the rule gives k_p 137, k_i 4.
+ * No D part is used, on a 0.01 K quantised temperature it only causes valve moves.
+ *
+ * Controller formats (see control.h): flow = 128 + k_p * e / 256, d = 128
+ *   k_p = 256 * 4 * 128 / (pi * 16 * a) = AUTOTUNE_KP_NUM / a
+ *   k_i = 16 * k_p / Ti = 32 * k_p / Tu
+ */
+#define AUTOTUNE_HYSTERESIS 10 /* 0.01 K */
+#define AUTOTUNE_KP_NUM 2608L
+#define AUTOTUNE_SKIP_CYCLES 1 /* first cycle starts from an arbitrary state */
+#define AUTOTUNE_CYCLES 3 /* averaged cycles */
+#define AUTOTUNE_TIMEOUT_S (48UL * 3600)
+
+/* Plausibility limits */
+#define AUTOTUNE_A_MIN 10 /* 0.01 K, smaller is noise */
+#define AUTOTUNE_A_MAX 500
+#define AUTOTUNE_TU_MIN (10UL * 60) /* s */
+#define AUTOTUNE_TU_MAX (12UL * 3600)
+#define AUTOTUNE_KP_MIN 20
+#define AUTOTUNE_KP_MAX 400 /* the valve is fully open at 0.6 K error */
+
+autotune_state_t autotune_state;
+
+static uint8_t autotune_on;
+static uint8_t autotune_cycles;
+static uint32_t autotune_start;
+static uint32_t autotune_cycle_start;
+static uint32_t autotune_switch_off; /* time the valve was closed in the current cycle */
+static uint32_t autotune_period_sum;
+static uint32_t autotune_on_sum;
+static uint16_t autotune_amplitude_sum;
+static int16_t autotune_max;
+static int16_t autotune_min;
+
+static void autotuneRelay(uint8_t on)
+{
+    autotune_on = on;
+    valveSetFlow(on ? 255 : 0);
+}
+
+/**
+ * Starts the experiment around the current nominal temperature.
+ * The controller is suspended until autotunePeriodic() finishes.
+ */
+void autotuneStart(void)
+{
+    autotune_state = AUTOTUNE_RUNNING;
+    autotune_start = rtcGetSeconds();
+    autotune_cycles = 0;
+    autotune_cycle_start = 0;
+    autotune_period_sum = 0;
+    autotune_on_sum = 0;
+    autotune_amplitude_sum = 0;
+    autotune_max = autotune_min = getNtcTemperature();
+    autotuneRelay(getNtcTemperature() < getNominalTemperature());
+    debugString("Autotune start\r\n");
+}
+
+static void autotuneFinish(void)
+{
+    uint16_t a = autotune_amplitude_sum / AUTOTUNE_CYCLES;
+    uint32_t tu = autotune_period_sum / AUTOTUNE_CYCLES;
+    int16_t k_p, k_i;
+    int32_t i_val;
+
+    if (a < AUTOTUNE_A_MIN || a > AUTOTUNE_A_MAX) {
+        autotune_state = AUTOTUNE_FAILED_AMPLITUDE;
+        return;
+    }
+    if (tu < AUTOTUNE_TU_MIN || tu > AUTOTUNE_TU_MAX) {
+        autotune_state = AUTOTUNE_FAILED_PERIOD;
+        return;
+    }
+    k_p = AUTOTUNE_KP_NUM / a;
+    if (k_p < AUTOTUNE_KP_MIN || k_p > AUTOTUNE_KP_MAX) {
+        autotune_state = AUTOTUNE_FAILED_AMPLITUDE;
+        return;
+    }
+    k_i = (32L * k_p + tu / 2) / tu;
+    if (k_i < 1) {
+        k_i = 1;
+    }
+    /* The mean relay output is the flow this room needs at the setpoint, start the I part there. */
+    i_val = ((int32_t)autotune_on_sum * 255 / (int32_t)autotune_period_sum - 128) * 256;
+    if (i_val > controller.i_max) {
+        i_val = controller.i_max;
+    } else if (i_val < -controller.i_max) {
+        i_val = -controller.i_max;
+    }
+
+    debugString("Autotune a/Tu/kp/ki ");
+    debugNumber(a);
+    debugNumber(tu / 60);
+    debugNumber(k_p);
+    debugNumber(k_i);
+    controlSetGains(k_p, k_i, 0, i_val);
+    autotune_state = AUTOTUNE_DONE;
+}
+
+/* Replaces control() while the experiment is running. */
+void autotunePeriodic(void)
+{
+    uint32_t now = rtcGetSeconds();
+    int16_t t = getNtcTemperature();
+    int16_t sp = getNominalTemperature();
+
+    if (now - autotune_start > AUTOTUNE_TIMEOUT_S) {
+        autotune_state = AUTOTUNE_FAILED_TIMEOUT;
+        return;
+    }
+    if (t > autotune_max) {
+        autotune_max = t;
+    }
+    if (t < autotune_min) {
+        autotune_min = t;
+    }
+    if (autotune_on && t > sp + AUTOTUNE_HYSTERESIS) {
+        autotune_switch_off = now;
+        autotuneRelay(0);
+    } else if (!autotune_on && t < sp - AUTOTUNE_HYSTERESIS) {
+        /* A new cycle starts each time the valve opens. */
+        if (autotune_cycle_start && autotune_cycles >= AUTOTUNE_SKIP_CYCLES) {
+            autotune_period_sum += now - autotune_cycle_start;
+            autotune_on_sum += autotune_switch_off - autotune_cycle_start;
+            autotune_amplitude_sum += (autotune_max - autotune_min) / 2;
+        }
+        if (autotune_cycle_start) {
+            autotune_cycles++;
+        }
+        autotune_cycle_start = now;
+        autotune_max = autotune_min = t;
+        autotuneRelay(1);
+        if (autotune_cycles >= AUTOTUNE_SKIP_CYCLES + AUTOTUNE_CYCLES) {
+            autotuneFinish();
+        }
+    }
+}
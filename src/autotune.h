@@ -0,0 +1,22 @@
+/* PID auto-tuning by relay feedback. */
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+#include <stdint.h>
+
+typedef enum
+{
+    AUTOTUNE_IDLE, /* never run */
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE, /* new gains stored */
+    AUTOTUNE_FAILED_AMPLITUDE, /* oscillation too small or too large */
+    AUTOTUNE_FAILED_PERIOD, /* oscillation too fast or too slow */
+    AUTOTUNE_FAILED_TIMEOUT
+} autotune_state_t;
+
+extern autotune_state_t autotune_state;
+
+void autotuneStart(void);
+void autotunePeriodic(void);
+#define autotuneActive() (autotune_state == AUTOTUNE_RUNNING)
+
+#endif /* AUTOTUNE_H_ */
@@ -0,0 +1,91 @@
+#include <avr/io.h>
+#include <avr/power.h>
+#include <avr/interrupt.h>
+
+#include "clock.h"
+#include "adc.h"
+#include "power.h"
+#include "config.h"
+#include "debug.h"
+
+/* Clock scaling
+ *
+ * The fuses start the CPU at F_CPU (8 MHz RC / 8). Computations (NTC conversion, controller, program,
+ * packets) run at a higher clock: the cycles should cost about the same charge while the time awake with
+ * everything else powered shrinks. This is not measured yet, CLOCK_DEBUG_WAKE gives the ticks for it.
+ * Busy waits (ADC, motor, EEPROM, radio start-up and transmit) run at F_CPU.
+ * 8 MHz needs 2.7 V, so below CLOCK_8MHZ_MV the bursts run at 4 MHz.
+ *
+ * Everything derived from the CPU clock has to follow:
+ * - the debug UART is only powered while it sends, it is set up for the current clock each time
+ * - _delay_us()/_delay_ms() are repeated, see clockDelayUs()
+ * - getAdc() drops to F_CPU, so the ADC prescaler and the conversion wait stay as they are
+ * - SPI runs at half the CPU clock, at most 4 MHz which the nRF24L01 takes
+ * The LCD, the RTC (timer 2) and the EEPROM run from their own clocks.
+ */
+uint8_t clock_div = CLOCK_DIV_SLOW;
+
+#ifdef CLOCK_DEBUG_WAKE
+static uint16_t clock_ticks[2]; /* timer 1 ticks (8 cycles) of this wake-up at F_CPU and faster */
+
+static void clockCount(void)
+{
+    clock_ticks[clock_div != CLOCK_DIV_SLOW] += TCNT1;
+    TCNT1 = 0;
+}
+#endif
+
+/** Sets the CLKPR prescaler (CLOCK_DIV_*) and adapts the peripherals which depend on it. */
+void clockSet(uint8_t div)
+{
+    if (div == clock_div) {
+        return;
+    }
+#ifdef CLOCK_DEBUG_WAKE
+    clockCount();
+#endif
+    uint8_t sreg = SREG;
+    cli();
+    clock_prescale_set((clock_div_t)div);
+    clock_div = div;
+    SREG = sreg;
+}
+
+/** Raises the clock for a compute burst, as far as the battery voltage allows. */
+void clockFast(void)
+{
+    clockSet(getBatteryVoltage() >= CLOCK_8MHZ_MV ? CLOCK_DIV_8MHZ : CLOCK_DIV_4MHZ);
+}
+
+/** Back to F_CPU after a burst. */
+void clockSlow(void)
+{
+    clockSet(CLOCK_DIV_SLOW);
+}
+
+#ifdef CLOCK_DEBUG_WAKE
+/** Starts counting the cycles of a wake-up with timer 1. Must not be used with CONTROL_DEBUG_CYCLES. */
+void clockDebugStart(void)
+{
+    pwrAcquire(PRTIM1);
+    TCNT1 = 0;
+    TCCR1B = (1 << CS11);
+    clock_ticks[0] = 0;
+    clock_ticks[1] = 0;
+}
+
+/**
+ * Prints the cycles / 8 of the wake-up at F_CPU and faster. Charge per wake-up:
+ * ticks * 8 / f * I(f) for both clocks, with the supply current I(f) measured at each of them.
+ */
+void clockDebugPrint(void)
+{
+    clockCount();
+    TCCR1B = 0;
+    pwrRelease(PRTIM1);
+    debugString("wake ticks slow ");
+    debugNumber(clock_ticks[0]);
+    debugString("fast ");
+    debugNumber(clock_ticks[1]);
+}
+#endif
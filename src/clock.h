@@ -0,0 +1,33 @@
+/* CPU clock scaling: compute bursts run at up to 8 MHz, waits and everything else at F_CPU. */
+#ifndef CLOCK_H_
+#define CLOCK_H_
+#include <stdint.h>
+#include <util/delay.h>
+
+/* Count the cycles of each main loop pass at both clocks with timer 1 and print them on the debug UART. */
+//#define CLOCK_DEBUG_WAKE
+
+/* CLKPR prescaler of the 8 MHz RC oscillator (2^n), F_CPU is 8 MHz / 8 */
+#define CLOCK_DIV_SLOW 3
+#define CLOCK_DIV_4MHZ 1
+#define CLOCK_DIV_8MHZ 0
+
+extern uint8_t clock_div;
+
+void clockSet(uint8_t div);
+void clockFast(void);
+void clockSlow(void);
+
+/* The CPU runs at F_CPU * clockSpeedup(). */
+#define clockSpeedup() ((uint8_t)(1 << (CLOCK_DIV_SLOW - clock_div)))
+
+/* _delay_us() and _delay_ms() count cycles of F_CPU, so they are repeated at a higher clock. */
+#define clockDelayUs(us) do { for (uint8_t clock_n = clockSpeedup(); clock_n; clock_n--) _delay_us(us); } while (0)
+#define clockDelayMs(ms) do { for (uint8_t clock_n = clockSpeedup(); clock_n; clock_n--) _delay_ms(ms); } while (0)
+
+#ifdef CLOCK_DEBUG_WAKE
+void clockDebugStart(void);
+void clockDebugPrint(void);
+#endif
+
+#endif /* CLOCK_H_ */
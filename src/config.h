@@ -28,6 +28,38 @@
  *************************************************************************/
 #define F_TIMER 64 /* Hz, LCD frame IRQ */
 
+/*************************************************************************
+ ***************************** Clock *************************************
+ *************************************************************************/
+/* Compute bursts run at 8 MHz from this battery voltage (mV) on, at 4 MHz below (see clock.cpp).
+ * The datasheet allows 8 MHz from 2.7 V and 4 MHz from 1.8 V. */
+#define CLOCK_8MHZ_MV 2800
+
+/*************************************************************************
+ *************************** Control *************************************
+ *************************************************************************/
+/* Controller runs between CONTROL_INTERVAL_MIN_S (large error or slope) and CONTROL_INTERVAL_MAX_S
+ * (steady state). CONTROL_INTERVAL_S is used while it is suspended (autotune, open window). */
+#define CONTROL_INTERVAL_S 60
+#define CONTROL_INTERVAL_MIN_S 10
+#define CONTROL_INTERVAL_MAX_S 300
+
+/* Heat now (OK key): PROGRAM_BOOST_TEMPERATURE (0.01 degC) for PROGRAM_BOOST_S, overrides the weekly program */
+#define PROGRAM_BOOST_TEMPERATURE 2300
+#define PROGRAM_BOOST_S (60 * 60)
+
+/* Open window: a temperature drop of WINDOW_DROP (0.01 K) within WINDOW_SPAN_S closes the valve
+ * for WINDOW_CLOSE_S. No new detection for WINDOW_BACKOFF_S afterwards.
+ * WINDOW_SPAN_S must not be shorter than CONTROL_INTERVAL_MAX_S, the temperature is only sampled that often
+ * in steady state. */
+#define WINDOW_DROP 40
+#define WINDOW_SPAN_S 300
+#define WINDOW_CLOSE_S (15 * 60)
+#define WINDOW_BACKOFF_S (30 * 60)
+
+/* History: one entry with the averages of each HISTORY_INTERVAL_S, see history.cpp */
+#define HISTORY_INTERVAL_S (60 * 60)
+
 /*************************************************************************
  **************************** Motor **************************************
  *************************************************************************/
@@ -48,6 +80,11 @@
 #define MOTOR_MAX_RUNTIME_CLOSE_S 15
 #define MOTOR_MIN_RANGE 300
 
+/* Motion policy: requests closer than this to the current position are ignored (motor counts). */
+#define MOTION_DEADBAND 8
+/* Minimum time between two valve moves in seconds. Requests in between are coalesced. */
+#define MOTION_MIN_INTERVAL_S 120
+
 /*************************************************************************
  *************************** Keys / Encoder ******************************
  *************************************************************************/
@@ -80,6 +117,16 @@
 #define POWERLOSS_PORTIN PINE
 #define POWERLOSS_DDR DDRE
 #define POWERLOSS_PIN PE5
+/* Time from the power loss edge until the shutdown record must be written (us), see sysShutdown() */
+#define POWERLOSS_BUDGET_US 30000
+/* EEPROM byte write time (datasheet: 3.4 ms) */
+#define EEPROM_WRITE_US 3400
+
+/* Pins which would float, they get pull-ups in pwrInit(): MISO while the radio is not selected,
+ * RXD without a debug adapter and the JTAG pins PF4 and PF6. */
+#define UNUSED_PINS_B (1 << SPI_PIN_MISO)
+#define UNUSED_PINS_E (1 << PE0)
+#define UNUSED_PINS_F ((1 << PF4) | (1 << PF6))
 
 /*************************************************************************
  ******************************* NTC *************************************
@@ -98,11 +145,40 @@
 #define NRF24L01_PIN_CE PF7
 #define NRF24L01_PORT_CSN PORTF
 #define NRF24L01_PIN_CSN PF5
+/* IRQ output (active low) on the pin change interrupt 0, see PCINT0_vect */
+#define NRF24L01_PORTIN_IRQ PINE
+#define NRF24L01_PIN_IRQ PE4
 #define SPI_PIN_SCK PB1
 #define SPI_PIN_MOSI PB2
 #define SPI_PIN_MISO PB3
 #define SPI_DDR DDRB
 
+/* The radio listens this long after each report, see Radio::periodic() */
+#define RADIO_LISTEN_MS 100
+/* Commands with the ACK of a report (dynamic payload length and ACK payloads in FEATURE/DYNPD). The base
+ * station has to use dynamic payload length then. 0 for base stations with fixed payloads: all commands come
+ * in the listen window, which is then also opened after each poll */
+#ifndef RADIO_ACK_PAYLOAD
+#define RADIO_ACK_PAYLOAD 1
+#endif
+/* Time slots per minute and their length, nodes with different TINY_UDP_DEFAULT_IP modulo RADIO_SLOTS
+ * do not collide (see Radio::periodic()) */
+#define RADIO_SLOTS 30
+#define RADIO_SLOT_S 2
+/* Report on change: values are sent when a field moved by its threshold since the last report,
+ * otherwise after RADIO_HEARTBEAT_S */
+#define RADIO_HEARTBEAT_S (20 * 60)
+/* Without changes every RADIO_POLL_CHECKS-th check sends a poll, so commands queued at the base station
+ * wait at most that many minutes instead of RADIO_HEARTBEAT_S */
+#define RADIO_POLL_CHECKS 5
+#define RADIO_DELTA_TEMPERATURE 20 /* 0.01 K */
+#define RADIO_DELTA_VALVE 10 /* motor counts */
+#define RADIO_DELTA_BATTERY 2 /* 0.1 V */
+/* Transmit power: one step down after RADIO_POWER_CLEAN packets in a row went through without a
+ * retransmit, one step up after a packet which needed RADIO_POWER_RETRIES retransmits or was lost */
+#define RADIO_POWER_CLEAN 32
+#define RADIO_POWER_RETRIES 2
+
 /* How often should we try to communicate with the NRF module before giving up? */
 #define NRF24L01_MAX_RETRIES 10
 #define NRF24L01_DEFAULT_ENABLED_PIPES 0b10
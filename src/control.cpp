@@ -1,13 +1,32 @@
 #include <avr/io.h>
+#include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <util/delay.h>
 
 #include "ntc.h"
-#include "motor.h"
+#include "rtc.h"
+#include "valve.h"
+#include "window.h"
+#include "autotune.h"
 #include "control.h"
+#include "power.h"
+#include "config.h"
+#include "debug.h"
 
-int16_t targetTemperature;
+/* Measure cycles of each control() run with timer 1 and print them on the debug UART. */
+//#define CONTROL_DEBUG_CYCLES
+
+/* Largest error taken into account (0.01 K). Larger errors saturate the P part anyway. */
+#define CONTROL_E_MAX 2000
+/* Longer pauses (e.g. after a long sleep) are limited to this (seconds), so that the I part
+ * does not jump. */
+#define CONTROL_DT_MAX 600
+/* Error (0.01 K) and slope (0.01 K/min) which are treated as steady state by controlInterval(). */
+#define CONTROL_E_QUIET 10
+#define CONTROL_SLOPE_QUIET 1
+
+int16_t targetTemperature = 2000;
 
 /* a controller result of 0 will set vent to halve open */
 controller_t controller = { 150, /* k_p */
@@ -15,33 +34,139 @@ controller_t controller = { 150, /* k_p */
 2, /* k_i */
 -15000, /* i_val */
 20000, /* i_max */
-0, /* e_last */
+0, /* temperature_last */
 0, /* t_last */
 5, /* i_scale_off factor */
 2, /* i_scale_p factor*/
 100 /* i_scale_p_lim aware: not scaled!*/
 };
 
+#define CONTROL_GAINS_VERSION 1
+
+/* Gains found by autotune, used instead of the defaults above. */
+struct control_gains_t
+{
+    uint8_t version;
+    int16_t k_p;
+    int16_t k_i;
+    int16_t k_d;
+    int16_t i_val; /* starting point of the I part */
+};
+
+static control_gains_t EEMEM control_eegains;
+
+#define SAT16_MAX 32767
+#define SAT16_MIN (-32767 - 1)
+
+static force_inline int16_t sat16(int32_t x)
+{
+    if (x > SAT16_MAX)
+        return SAT16_MAX;
+    if (x < SAT16_MIN)
+        return SAT16_MIN;
+    return x;
+}
+
+/* Saturating multiply-accumulate: acc + a * b limited to 16 bit. */
+static force_inline int16_t mac16(int16_t acc, int16_t a, int16_t b)
+{
+    return sat16((int32_t)acc + (int32_t)a * b);
+}
+
+static int16_t limit(int16_t x, int16_t max)
+{
+    if (x > max)
+        return max;
+    if (x < -max)
+        return -max;
+    return x;
+}
+
+static uint32_t control_next;
+
+static uint16_t quiet(int16_t x, int16_t band)
+{
+    if (x < 0)
+        x = -x;
+    return x > band ? x - band : 0;
+}
+
 /**
- * controller main function. Has to be called some times.
- * exact timing does not matter, but once a minute should be the minimum!
+ * Time until the next controller run (seconds).
+ * A settled room (small error, flat temperature) is only looked at every CONTROL_INTERVAL_MAX_S.
+ * The interval shrinks with the error and even more with the slope, as a fast temperature change
+ * (window, sun) needs a fast reaction: 1 K error ~ 40 s, 0.3 K/min ~ 15 s.
+ * @param slope temperature change in 0.01 K/min
+ */
+static uint16_t controlInterval(int16_t e, int16_t slope)
+{
+    uint16_t activity = quiet(slope, CONTROL_SLOPE_QUIET);
+    uint16_t interval;
+    if (activity > 2 * CONTROL_INTERVAL_MAX_S) {
+        return CONTROL_INTERVAL_MIN_S;
+    }
+    activity = 2 * activity + quiet(e, CONTROL_E_QUIET) / 4;
+    interval = 4 * CONTROL_INTERVAL_MAX_S / (4 + activity);
+    return interval < CONTROL_INTERVAL_MIN_S ? CONTROL_INTERVAL_MIN_S : interval;
+}
+
+/**
+ * controller main function. Has to be called once controlNextRun() is reached,
+ * it chooses its next run depending on how far the room is from the set-point.
  * @pre system status variables (temperature) should be up2date!
  */
 void control(void)
 {
-#if 0
+    if (autotuneActive()) {
+        autotunePeriodic();
+        control_next = rtcGetSeconds() + CONTROL_INTERVAL_S;
+        return;
+    }
+    if (windowIsOpen()) {
+        /* Keep the controller state, but do not integrate over the closed period. */
+        valveSetFlow(0);
+        controller.t_last = rtcGetSeconds();
+        controller.temperature_last = getNtcTemperature();
+        control_next = controller.t_last + CONTROL_INTERVAL_S;
+        if (windowNextChange() < control_next) {
+            control_next = windowNextChange();
+        }
+        return;
+    }
+#ifdef CONTROL_DEBUG_CYCLES
+    pwrAcquire(PRTIM1);
+    TCNT1 = 0;
+    TCCR1B = (1 << CS10);
+#endif
     controller_t ctrl = controller;
-    uint32_t systemTime = SystemTime;
-    uint8_t deltaTime = systemTime - controller.t_last;
-    int16_t e = targetTemperature - getNtcTemperature();
-    int16_t up = ctrl.k_p * e;
-    /* scale differential part here so we can use it easier */
-    int16_t ud = (((int16_t) ctrl.k_d * (e - ctrl.e_last)) / deltaTime) * 256;
-    int16_t ui;
-    int16_t i_change;
+    uint32_t systemTime = rtcGetSeconds();
+    uint16_t deltaTime = CONTROL_DT_MAX;
+    int16_t temperature = getNtcTemperature();
+    int16_t e = limit(targetTemperature - temperature, CONTROL_E_MAX);
+    int16_t up = mac16(0, ctrl.k_p, e);
+    int16_t ud = 0;
+    int16_t i_change = 0;
+    int16_t slope = 0;
     int16_t result;
 
-    i_change = ctrl.k_i * e * deltaTime / 16;
+    if (!ctrl.t_last) {
+        /* First run: No history for D and I part. */
+        deltaTime = 0;
+    } else if (systemTime - ctrl.t_last < CONTROL_DT_MAX) {
+        deltaTime = systemTime - ctrl.t_last;
+    }
+
+    if (deltaTime) {
+        /* D part and slope from the measured temperature: a set-point step (program, boost) is no change
+         * of the room and must neither kick the valve nor shorten the interval.
+         * scale differential part here so we can use it easier.
+         * Divisions are done at 16 bit, avr-libgcc's 16 bit division routine is shorter than the 32 bit one.
+         * CONTROL_DEBUG_CYCLES measures the whole run on the target. */
+        int16_t rise = sat16((int32_t)temperature - ctrl.temperature_last);
+        ud = mac16(0, sat16(-(int32_t)ctrl.k_d * rise) / (int16_t)deltaTime, 256);
+        i_change = mac16(0, sat16(((int32_t)ctrl.k_i * e) >> 4), deltaTime);
+        slope = mac16(0, rise, 60) / (int16_t)deltaTime;
+    }
     /* todo:
      *   // dampen effect of turned of heater
      * if(i_change > 0 && heaterStatusOff)
@@ -54,29 +179,76 @@ void control(void)
     if (i_change > 0 && (up) / 256 > ctrl.i_scale_p_lim)
         i_change /= ctrl.i_scale_p;
 
-    ctrl.i_val += i_change;
-
-    if (ctrl.i_val > ctrl.i_max)
-        ctrl.i_val = ctrl.i_max;
-    else if (ctrl.i_val < -ctrl.i_max)
-        ctrl.i_val = -ctrl.i_max;
-
-    ui = ctrl.i_val;
+    /* Anti windup: Do not integrate further into a saturated output. */
+    result = sat16((int32_t)up + ud + ctrl.i_val);
+    if (!((result == SAT16_MAX && i_change > 0) || (result == SAT16_MIN && i_change < 0))) {
+        ctrl.i_val = limit(sat16((int32_t)ctrl.i_val + i_change), ctrl.i_max);
+        result = sat16((int32_t)up + ud + ctrl.i_val);
+    }
 
-    result = up + ud + ui;
-    motorMoveTo((128 + result / 256));
+    valveSetFlow(128 + (result >> 8));
 
-    ctrl.e_last = e;
+    ctrl.temperature_last = temperature;
     ctrl.t_last = systemTime;
     controller = ctrl;
+    control_next = systemTime + controlInterval(e, slope);
+    if (windowNextChange() < control_next) {
+        control_next = windowNextChange();
+    }
+#ifdef CONTROL_DEBUG_CYCLES
+    uint16_t cycles = TCNT1;
+    TCCR1B = 0;
+    pwrRelease(PRTIM1);
+    debugString("control cycles ");
+    debugNumber(cycles);
 #endif
 }
 
+/** Returns when control() wants to run next (rtc seconds). */
+uint32_t controlNextRun(void)
+{
+    return control_next;
+}
+
+/** Runs control() at the next main loop pass, e.g. when an open window was detected. */
+void controlRunNow(void)
+{
+    control_next = 0;
+}
+
+/** Loads the gains stored by controlSetGains(). Keeps the defaults if there are none. */
+void controlInit(void)
+{
+    control_gains_t gains;
+    eeprom_read_block(&gains, &control_eegains, sizeof(gains));
+    if (gains.version == CONTROL_GAINS_VERSION) {
+        controller.k_p = gains.k_p;
+        controller.k_i = gains.k_i;
+        controller.k_d = gains.k_d;
+        controller.i_val = gains.i_val;
+    }
+}
+
+/** Sets new gains and stores them in the EEPROM. */
+void controlSetGains(int16_t k_p, int16_t k_i, int16_t k_d, int16_t i_val)
+{
+    control_gains_t gains = { CONTROL_GAINS_VERSION, k_p, k_i, k_d, i_val };
+    controller.k_p = k_p;
+    controller.k_i = k_i;
+    controller.k_d = k_d;
+    controller.i_val = i_val;
+    eeprom_update_block(&gains, &control_eegains, sizeof(gains));
+}
+
 /**
  * should be called to set nominal temperature.
  * @param temperature
  */
 void setNominalTemperature(int16_t temperature)
 {
+    if (temperature != targetTemperature) {
+        /* react on the new set-point right away */
+        control_next = 0;
+    }
     targetTemperature = temperature;
 }
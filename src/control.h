@@ -1,28 +1,41 @@
 /* PID control algorithm. */
 #ifndef CONTROL_H_
 #define CONTROL_H_
+#include <stdint.h>
 
 extern int16_t targetTemperature;
 
+void controlInit(void);
 void control(void);
+uint32_t controlNextRun(void);
+void controlRunNow(void);
+void controlSetGains(int16_t k_p, int16_t k_i, int16_t k_d, int16_t i_val);
 void setNominalTemperature(int16_t temperature);
 #define getNominalTemperature() ((const int16_t) targetTemperature)
 
 /**
+ * Fixed point formats:
+ * - e: control error in 0.01 K (same as temperatures), limited to +-CONTROL_E_MAX
+ * - controller output: Q8.8 flow offset, i.e. output/256 is added to half open flow (128).
+ *   +-32767 covers the whole valve range.
+ *
  * all controller parameters will be scaled by 256.
  * this allows a full valve open/close just by I part.
  * -> p = 1 will give 1 at output for e = 2.56 degrees
+ *
+ * All products are calculated at 32 bit and saturated to 16 bit, so large errors
+ * only drive the output to its limits instead of wrapping around.
  */
 typedef struct
 {
     int16_t k_p; /* scaled by 256 as noted above */
-    int16_t k_d; /* NOT scaled by 256 */
-    int16_t k_i; /* scaled by an additional factor of 16 */
+    int16_t k_d; /* NOT scaled by 256, output change per 0.01 K/s */
+    int16_t k_i; /* scaled by an additional factor of 16, per second */
 
     int16_t i_val; /* this is normally scaled (256) */
     int16_t i_max; /* will be taken as maximum and minimum */
-    int16_t e_last;
-    uint32_t t_last;
+    int16_t temperature_last; /* measured at the last run, D part and slope follow the room, not the set-point */
+    uint32_t t_last; /* rtcGetSeconds() of the last run, 0: never run */
     uint8_t i_scale_off; /* divide integral value additions by that when heater is off */
     uint8_t i_scale_p; /* divide same for large p values */
     int8_t i_scale_p_lim; /* (p) > (lim*256) activates i_scale_p */
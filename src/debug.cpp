@@ -1,24 +1,43 @@
 #include "debug.h"
 #include "config.h"
+#include "power.h"
+#include "clock.h"
 #include <stdlib.h>
 #include <avr/io.h>
 
 #define UBRR_value (F_CPU/8/DEBUG_BAUD-1)
-void debugInit(void)
+
+/* The USART is only powered while a string is sent. It is set up for the current CPU clock at power up. */
+static void debugStart(void)
+{
+    if (pwrAcquire(PRUSART0)) {
+        UBRR0 = (UBRR_value + 1) * clockSpeedup() - 1;
+        UCSR0A = _BV(U2X0);
+        UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+        UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); //8n1
+    }
+}
+
+/* Waits until the last character has left, so the USART can be powered down. */
+static void debugStop(void)
 {
-    UBRR0 = UBRR_value;
-    UCSR0A = _BV(U2X0);
-    UCSR0B = _BV(RXEN0) | _BV(TXEN0);
-    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); //8n1
+    while (!(UCSR0A & _BV(TXC0)));
+    pwrRelease(PRUSART0);
 }
 
 void debugString(const char *s)
 {
     char c;
+    if (!DEBUG_ENABLED || !*s) {
+        return;
+    }
+    debugStart();
     while ((c = *s++)) {
         while (!(UCSR0A & _BV(UDRE0)));
+        UCSR0A = _BV(U2X0) | _BV(TXC0); /* clears TXC */
         UDR0 = c;
     }
+    debugStop();
 }
 
 void debugNumber(int16_t n)
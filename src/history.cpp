@@ -0,0 +1,190 @@
+#include <avr/eeprom.h>
+
+#include "history.h"
+#include "control.h"
+#include "ntc.h"
+#include "valve.h"
+#include "rtc.h"
+#include "config.h"
+
+/* Encoding
+ *
+ * Every HISTORY_INTERVAL_S the averages of room temperature and valve flow over the interval and the
+ * nominal temperature are appended as an entry of one to four bytes:
+ *
+ *   1ccccvvv           c 0-13: temperature change of (c - 7) * 0.1 K to the entry before,
+ *                      c 14: absolute temperature follows, c 15: unused (0xFF is the end marker),
+ *                      v: valve flow / 32
+ *   0ttttttt 0ttttttt  absolute temperature + 40 degC in 0.01 K, high bits first (only with c 14)
+ *   0sssssss           nominal temperature in 0.25 degC (see program_t), after a change and with c 14
+ *
+ * Changes are rounded against the temperature a decoder reconstructs, so the error does not add up.
+ * Larger changes and every HISTORY_ANCHOR-th entry carry the absolute temperature, a decoder starts at the
+ * first of them once the oldest entries are overwritten. Only the first byte of an entry has the top bit
+ * set, so entries cut by the wrap around are skipped.
+ *
+ * Size of a week at one entry per hour (sim/thermal, setback scenario): 168 entries, 29 absolute
+ * temperatures (every HISTORY_ANCHOR entries and after setpoint rises) with 2 bytes more each, and 43
+ * set-point bytes (14 changes, one after each absolute temperature): 168 + 58 + 43 = 269 of the 327
+ * usable bytes. Airing twice a day adds absolute temperatures: 168 + 2 * 50 + 64 = 332 bytes, the ring
+ * then covers about 6.9 days. At 40 minutes the setback week took 365 bytes.
+ * Each cell is written once per round. The end marker behind the newest entry is found by a scan at boot.
+ */
+#define HISTORY_HEAD 0x80
+#define HISTORY_END 0xFF
+#define HISTORY_DELTA_MIN (-7)
+#define HISTORY_DELTA_MAX 6
+#define HISTORY_ABSOLUTE 14
+#define HISTORY_ANCHOR 24
+#define HISTORY_OFFSET 4000 /* 0.01 K, absolute temperatures start at -40 degC */
+#define HISTORY_ABSOLUTE_MAX 0x3FFF
+#define HISTORY_SETPOINT_MAX 0x7F
+#define HISTORY_SETPOINT_NONE 0xFF
+
+static uint8_t EEMEM history_ring[HISTORY_SIZE];
+
+static uint16_t history_head; /* position of the end marker */
+static uint32_t history_next; /* rtcGetSeconds() of the next entry */
+static uint32_t history_last; /* rtcGetSeconds() of the newest entry, 0: none since boot */
+static uint32_t history_updated; /* rtcGetSeconds() of the last historyPeriodic() */
+static int32_t history_sum_temperature; /* integrals since the newest entry */
+static uint32_t history_sum_flow;
+static uint16_t history_sum_time;
+static int16_t history_temperature; /* temperature as reconstructed from the entries */
+static uint8_t history_setpoint;
+static uint8_t history_anchor; /* entries since the last absolute temperature */
+
+static uint16_t historyIndex(uint16_t i)
+{
+    return i >= HISTORY_SIZE ? i - HISTORY_SIZE : i;
+}
+
+/** Finds the end of the ring, the first entry after boot carries the absolute temperature. */
+void historyInit(void)
+{
+    history_head = 0;
+    for (uint16_t i = 0; i < HISTORY_SIZE; i++) {
+        if (eeprom_read_byte(&history_ring[i]) == HISTORY_END) {
+            history_head = i;
+            break;
+        }
+    }
+    history_anchor = HISTORY_ANCHOR;
+    history_updated = rtcGetSeconds();
+    history_next = history_updated + HISTORY_INTERVAL_S;
+}
+
+/* The new end marker is written first, a power loss in between only costs the oldest entry. */
+static void historyAppend(const uint8_t *entry, uint8_t n)
+{
+    uint16_t end = historyIndex(history_head + n);
+    eeprom_update_byte(&history_ring[end], HISTORY_END);
+    for (uint8_t i = 0; i < n; i++) {
+        eeprom_update_byte(&history_ring[historyIndex(history_head + i)], entry[i]);
+    }
+    history_head = end;
+}
+
+static void historySample(void)
+{
+    uint8_t entry[4];
+    uint8_t n = 1;
+    int16_t temperature = getNtcTemperature();
+    uint8_t flow = valveGetFlow();
+    int16_t setpoint = (getNominalTemperature() + 12) / 25;
+    if (history_sum_time) {
+        temperature = history_sum_temperature / history_sum_time;
+        flow = history_sum_flow / history_sum_time;
+    }
+    if (setpoint < 0) {
+        setpoint = 0;
+    } else if (setpoint > HISTORY_SETPOINT_MAX) {
+        setpoint = HISTORY_SETPOINT_MAX;
+    }
+
+    int16_t delta = temperature - history_temperature;
+    delta = (delta < 0 ? delta - 5 : delta + 5) / 10;
+    if (history_anchor >= HISTORY_ANCHOR || delta < HISTORY_DELTA_MIN || delta > HISTORY_DELTA_MAX) {
+        int16_t absolute = temperature + HISTORY_OFFSET;
+        if (absolute < 0) {
+            absolute = 0;
+        } else if (absolute > HISTORY_ABSOLUTE_MAX) {
+            absolute = HISTORY_ABSOLUTE_MAX;
+        }
+        entry[0] = HISTORY_HEAD | HISTORY_ABSOLUTE << 3 | flow >> 5;
+        entry[1] = absolute >> 7;
+        entry[2] = absolute & 0x7F;
+        n = 3;
+        history_temperature = absolute - HISTORY_OFFSET;
+        history_setpoint = HISTORY_SETPOINT_NONE;
+        history_anchor = 0;
+    } else {
+        entry[0] = HISTORY_HEAD | (delta - HISTORY_DELTA_MIN) << 3 | flow >> 5;
+        history_temperature += delta * 10;
+        history_anchor++;
+    }
+    if (setpoint != history_setpoint) {
+        history_setpoint = setpoint;
+        entry[n++] = setpoint;
+    }
+    historyAppend(entry, n);
+}
+
+/**
+ * Integrates temperature and flow and appends an entry every HISTORY_INTERVAL_S.
+ * Should be called from the main loop, historyNextRun() tells when the next entry is due.
+ */
+void historyPeriodic(void)
+{
+    uint32_t now = rtcGetSeconds();
+    uint16_t dt = now - history_updated;
+    history_updated = now;
+    history_sum_temperature += (int32_t)getNtcTemperature() * dt;
+    history_sum_flow += (uint32_t)valveGetFlow() * dt;
+    history_sum_time += dt;
+    if (now < history_next) {
+        return;
+    }
+    historySample();
+    history_sum_temperature = 0;
+    history_sum_flow = 0;
+    history_sum_time = 0;
+    history_last = now;
+    history_next += HISTORY_INTERVAL_S;
+    if (history_next <= now) {
+        history_next = now + HISTORY_INTERVAL_S;
+    }
+}
+
+/** Returns when the next entry is due (rtc seconds). */
+uint32_t historyNextRun(void)
+{
+    return history_next;
+}
+
+/**
+ * Copies the ring, oldest byte first, for a download. The end marker is left out.
+ * @param offset from the oldest byte, up to HISTORY_SIZE - 1
+ * @return number of bytes copied, 0 at the end
+ */
+uint8_t historyRead(uint16_t offset, uint8_t *buffer, uint8_t n)
+{
+    if (offset >= HISTORY_SIZE - 1) {
+        return 0;
+    }
+    if (n > HISTORY_SIZE - 1 - offset) {
+        n = HISTORY_SIZE - 1 - offset;
+    }
+    uint16_t i = historyIndex(history_head + 1 + offset);
+    for (uint8_t j = 0; j < n; j++) {
+        buffer[j] = eeprom_read_byte(&history_ring[i]);
+        i = historyIndex(i + 1);
+    }
+    return n;
+}
+
+/** Seconds since the newest entry, 0xFFFF if there was none since boot. */
+uint16_t historyAge(void)
+{
+    return history_last ? rtcGetSeconds() - history_last : 0xFFFF;
+}
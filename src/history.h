@@ -0,0 +1,16 @@
+/* Compressed temperature / set-point / valve history in the EEPROM, downloadable over the radio. */
+#ifndef HISTORY_H_
+#define HISTORY_H_
+#include <stdint.h>
+
+/* Size of the ring (bytes), one byte is the end marker. Takes the EEPROM the other modules leave free
+ * (512 - 184 bytes), which holds a week with a daily setback, see history.cpp. */
+#define HISTORY_SIZE 328
+
+void historyInit(void);
+void historyPeriodic(void);
+uint32_t historyNextRun(void);
+uint8_t historyRead(uint16_t offset, uint8_t *buffer, uint8_t n);
+uint16_t historyAge(void);
+
+#endif /* HISTORY_H_ */
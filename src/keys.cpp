@@ -14,6 +14,7 @@
 #include <avr/interrupt.h>
 
 #include "config.h"
+#include "power.h"
 #ifdef ENCODER
 #include "encoder.h"
 #endif
@@ -137,6 +138,7 @@ void keyInit(void)
 
 ISR(PCINT1_vect)
 {
+    pwrWake(PWR_WAKE_KEY);
     key_irq_turn_off_delay = 0;
     /* used for waking up the device by key press*/
     LCDCRA |= (1 << LCDIE);
@@ -2,6 +2,7 @@
 #include <avr/pgmspace.h>
 #include <stdlib.h>
 #include "lcd.h"
+#include "power.h"
 
 #define NUM_DIGITS 4
 
@@ -224,6 +225,7 @@ void displayNumber(int16_t num, int8_t width)
 
 void lcdInit(void)
 {
+    pwrAcquire(PRLCD);
     LCDCRB = (1 << LCDCS) | (1 << LCDMUX1) | (1 << LCDMUX0) | (1 << LCDPM2) | (1 << LCDPM1) | (1 << LCDPM0);
     /*
      (1<<LCDCS)                            // Das LCD wird im asynchronen Modus (LCDCS-Bit=1)
@@ -275,4 +277,5 @@ void lcdOff(void)
         ;
     // Disable LCD
     LCDCRA = 0;
+    pwrRelease(PRLCD);
 }
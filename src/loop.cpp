@@ -0,0 +1,59 @@
+#include "loop.h"
+#include "ntc.h"
+#include "valve.h"
+#include "motion.h"
+#include "rtc.h"
+#include "control.h"
+#include "preheat.h"
+#include "program.h"
+#include "store.h"
+#include "history.h"
+#include "menu.h"
+#include "power.h"
+#include "clock.h"
+#include "radio.h"
+
+/** Runs every module which is due. */
+void loopPeriodic(void)
+{
+    /* clockFast() picks the clock by the battery voltage, so it is measured first, also on the first pass.
+     * Then the compute burst, motor and EEPROM waits below run at F_CPU */
+    updateBattery();
+    clockFast();
+    updateNtcTemperature();
+    Radio::periodic();
+    programPeriodic();
+    preheatPeriodic();
+    if (rtcGetSeconds() >= controlNextRun()) {
+        control();
+    }
+    clockSlow();
+    if (motionPeriodic()) {
+        valveLearn();
+    }
+    storePeriodic();
+    historyPeriodic();
+    menu();
+}
+
+/** Returns the RTC second at which the next module needs to run. Keys and the power loss IRQ wake up earlier. */
+uint32_t loopNextRun(void)
+{
+    uint32_t next = controlNextRun();
+    if (Radio::nextRun() < next) {
+        next = Radio::nextRun();
+    }
+    if (motionNextRun() < next) {
+        next = motionNextRun();
+    }
+    if (programNextRun() < next) {
+        next = programNextRun();
+    }
+    if (preheatNextRun() < next) {
+        next = preheatNextRun();
+    }
+    if (historyNextRun() < next) {
+        next = historyNextRun();
+    }
+    return next;
+}
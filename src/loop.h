@@ -0,0 +1,9 @@
+/* One pass of the main loop. main() and the host simulation (sim/) run the same pass. */
+#ifndef LOOP_H_
+#define LOOP_H_
+#include <stdint.h>
+
+void loopPeriodic(void);
+uint32_t loopNextRun(void);
+
+#endif /* LOOP_H_ */
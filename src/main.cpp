@@ -7,13 +7,22 @@
 #include "keys.h"
 #include "ntc.h"
 #include "motor.h"
+#include "valve.h"
+#include "motion.h"
+#include "rtc.h"
 #include "adc.h"
 #include "control.h"
+#include "preheat.h"
+#include "program.h"
+#include "store.h"
+#include "history.h"
 #include "menu.h"
 #include "encoder.h"
 #include "power.h"
+#include "clock.h"
 #include "spi.h"
 #include "radio.h"
+#include "loop.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -23,6 +32,7 @@
  * This is used as a generic time base without having to waste power for a timer. */
 ISR(LCD_vect)
 {
+    pwrWake(PWR_WAKE_LCD);
     uint8_t keep_running = 0; /* If any handler returns non-zero this interrupt is kept enabled. */
     keep_running |= motorTimer();
     keep_running |= keyPeriodicScan();
@@ -49,14 +59,20 @@ ISR(PCINT0_vect)
 
     // save data when battery removed
     if (newState & (1 << POWERLOSS_PIN)) {
+        pwrWake(PWR_WAKE_POWERLOSS);
         sysShutdown();
     }
 
     // motor step
     if (changed & (1 << MOTOR_SENSE_PIN)) {
+        pwrWake(PWR_WAKE_MOTOR);
         motorIrq();
     }
 
+    // radio event, the IRQ line is active low
+    if ((changed & (1 << NRF24L01_PIN_IRQ)) && !(newState & (1 << NRF24L01_PIN_IRQ))) {
+        Radio::irq();
+    }
 }
 
 void ioInit(void)
@@ -69,27 +85,37 @@ void ioInit(void)
 int main(void)
 {
     _delay_ms(50);
-    debugInit();
     pwrInit();
     ioInit();
+    rtcInit();
     motorInit();
     lcdInit();
     keyInit();
     encoderInit();
     ntcInit();
-    spiInit();
     Radio::init();
+    valveInit();
+    controlInit();
+    preheatInit();
+    programInit();
+    storeInit();
+    historyInit();
     sei();
     debugString("Init done\r\n");
     while (!motorIsAdapted()) {
         motorAdapt();
     }
+    valveLearn();
     while (1) {
-        updateNtcTemperature();
-        updateBattery();
-        Radio::periodic();
-        menu();
-        _delay_ms(1000);
-//        sysSleep();
+#ifdef CLOCK_DEBUG_WAKE
+        clockDebugStart();
+#endif
+        loopPeriodic();
+        uint32_t next = loopNextRun();
+#ifdef CLOCK_DEBUG_WAKE
+        clockDebugPrint();
+#endif
+        /* returns right away if next passed meanwhile or an interrupt came in during this pass */
+        sysSleep(next * RTC_TICKS_PER_SECOND);
     }
 }
@@ -10,12 +10,24 @@
 #include "lcd.h"
 #include "ntc.h"
 #include "radio.h"
+#include "window.h"
+#include "config.h"
+#include "keys.h"
+#include "program.h"
 
 void menu(void)
 {
+    if (get_key_press(1 << KEY_OK)) {
+        programBoost();
+    }
     displayNumber((getNtcTemperature()+5)/10, 3);
     displayAsciiDigit(LCD_DEGREE, 3);
     displaySymbols(LCD_DOT, LCD_DOT);
+    if (windowIsOpen()) {
+        displaySymbols(LCD_OUTHOUSE, LCD_OUTHOUSE);
+    } else {
+        displaySymbols(LCD_NONE, LCD_OUTHOUSE);
+    }
     if (Radio::state > Radio::RADIO_IDLE) {
         displaySymbols(LCD_TOWER, LCD_TOWER);
     } else {
@@ -0,0 +1,92 @@
+#include "motion.h"
+#include "motor.h"
+#include "rtc.h"
+#include "config.h"
+
+motion_stats_t motion_stats;
+
+static uint8_t motion_deadband = MOTION_DEADBAND;
+static uint16_t motion_min_interval = MOTION_MIN_INTERVAL_S;
+
+static uint8_t motion_pending;
+static uint8_t motion_urgent; /* pending move to an end position, not held back by the minimum interval */
+static int16_t motion_target;
+static uint32_t motion_last_move;
+static uint8_t motion_moved_once;
+
+/**
+ * Changes the motion policy until the next reset (debug command 0x6d70).
+ * @param deadband requests closer than this to the current position (motor counts) are ignored
+ * @param min_interval minimum time between two moves in seconds
+ */
+void motionSetPolicy(uint8_t deadband, uint16_t min_interval)
+{
+    motion_deadband = deadband;
+    motion_min_interval = min_interval;
+}
+
+/**
+ * Requests a new valve position. The move is done by motionPeriodic() once the minimum interval
+ * since the last move has passed. Bursts of requests are coalesced into a single move to the last one.
+ * The deadband is measured from where the motor is, so small requests cannot add up to a drift.
+ */
+void motionRequest(int16_t position)
+{
+    int16_t current = motorGetPosition();
+    int16_t max = motorGetMaxPosition();
+    int16_t diff = position - current;
+    if (diff < 0) {
+        diff = -diff;
+    }
+    /* End positions are always honoured and right away: small errors there mean an open or leaking valve,
+     * and closing for an open window should not wait. */
+    uint8_t end_position = position <= 0 ? current > 0 : position >= max && current < max;
+    if (motion_pending) {
+        /* Previous request gets replaced. */
+        motion_stats.suppressed++;
+        motion_pending = 0;
+    }
+    if (diff <= motion_deadband && !end_position && motion_moved_once) {
+        motion_stats.suppressed++;
+        return;
+    }
+    motion_target = position;
+    motion_pending = 1;
+    motion_urgent = end_position;
+}
+
+/**
+ * Executes a pending move if it is due. Should be called from the main loop.
+ * @return 1 if the motor was moved.
+ */
+uint8_t motionPeriodic(void)
+{
+    uint32_t now = rtcGetSeconds();
+    if (!motion_pending) {
+        return 0;
+    }
+    if (motion_moved_once && !motion_urgent && now - motion_last_move < motion_min_interval) {
+        return 0;
+    }
+    int16_t start = motorGetPosition();
+    motorSetPosition(motion_target);
+    int16_t moved = motorGetPosition() - start;
+    motion_stats.counts += moved < 0 ? -moved : moved;
+    motion_stats.executed++;
+    motion_pending = 0;
+    motion_last_move = now;
+    motion_moved_once = 1;
+    return 1;
+}
+
+/** Returns when motionPeriodic() has to run next (rtc seconds), RTC_NEVER if nothing is pending. */
+uint32_t motionNextRun(void)
+{
+    if (!motion_pending) {
+        return RTC_NEVER;
+    }
+    if (!motion_moved_once || motion_urgent) {
+        return 0;
+    }
+    return motion_last_move + motion_min_interval;
+}
@@ -0,0 +1,21 @@
+/* Motion policy: Trades control accuracy for actuator energy.
+ * All valve position changes should be requested here instead of calling motorSetPosition() directly. */
+#ifndef MOTION_H_
+#define MOTION_H_
+#include <stdint.h>
+
+typedef struct
+{
+    uint16_t executed; /* moves actually done */
+    uint16_t suppressed; /* requests within the deadband or replaced by a later request */
+    uint16_t counts; /* tacho counts moved, wraps around */
+} motion_stats_t;
+
+extern motion_stats_t motion_stats;
+
+void motionSetPolicy(uint8_t deadband, uint16_t min_interval);
+void motionRequest(int16_t position);
+uint8_t motionPeriodic(void);
+uint32_t motionNextRun(void);
+
+#endif /* MOTION_H_ */
@@ -30,6 +30,10 @@
 #define MOTOR_TIMEOUT ((uint16_t)((uint32_t)F_TIMER * MOTOR_TIMEOUT_MS / 1000 + 1))
 #define MOTOR_MAX_RUNTIME_OPEN ((uint16_t)((uint32_t)F_TIMER * MOTOR_MAX_RUNTIME_OPEN_S))
 #define MOTOR_MAX_RUNTIME_CLOSE ((uint16_t)((uint32_t)F_TIMER * MOTOR_MAX_RUNTIME_CLOSE_S))
+/* No load: ~1 count per frame. Waiting this long for a count means "high load" (< 16 counts/s). */
+#define MOTOR_CONTACT_FRAMES 4
+/* Ignore speed while the motor is accelerating. */
+#define MOTOR_SPINUP_FRAMES ((uint16_t)(F_TIMER / 8))
 #define DIR_OPEN 1
 #define DIR_CLOSE -1
 #define DIR_DISABLED 0
@@ -40,6 +44,8 @@ volatile uint16_t motor_runtime;
 volatile int16_t motor_position;
 volatile int16_t motor_position_max;
 volatile int16_t motor_position_target;
+volatile int16_t motor_contact_position; /* 0: not learned yet */
+static volatile uint8_t motor_contact_seen;
 
 /* TODO: Reduce number of accesses to volatile variable.
  * TODO: Make sure all 16 bit accesses are atomic.
@@ -51,7 +57,9 @@ static void motorEnable(void)
 {
     motor_runtime = 0;
     motor_timeout = 0;
+    motor_contact_seen = 0;
     MOTOR_SENSE_PORT |= (1 << MOTOR_SENSE_LED_PIN);
+    PCMSK0 |= (1 << MOTOR_SENSE_PIN);
     MOTOR_DDR |= (1 << MOTOR_PIN_L) | (1 << MOTOR_PIN_R);
     LCDCRA |= (1 << LCDIE); //Enable timer IRQ
 #ifdef MOTOR_DEBUG_POWER
@@ -65,6 +73,8 @@ static force_inline void motorDisable(void)
     MOTOR_PORT &= ~((1 << MOTOR_PIN_L) | (1 << MOTOR_PIN_R));
     MOTOR_DDR &= ~(1 << MOTOR_PIN_L) | (1 << MOTOR_PIN_R); //TODO: Does this actually conserve power?
     MOTOR_SENSE_PORT &= ~(1 << MOTOR_SENSE_LED_PIN);
+    /* The sensor output is held low with the LED off, no need to wake up for it. */
+    PCMSK0 &= ~(1 << MOTOR_SENSE_PIN);
 #ifdef MOTOR_DEBUG_POWER
     displaySymbols(LCD_NONE, LCD_LOCK);
 #endif
@@ -98,7 +108,6 @@ void motorInit(void)
 {
     motorDisable();
     MOTOR_SENSE_DDR |= (1 << MOTOR_SENSE_LED_PIN);
-    PCMSK0 |= (1 << MOTOR_SENSE_PIN);
 }
 
 void motorIrq(void)
@@ -117,6 +126,16 @@ uint8_t motorTimer(void)
     if (motor_running) {
         motor_runtime++;
     }
+    /* Valve seat contact: While closing the load rises sharply when the pin hits the valve seat.
+     * The first time the tacho stalls for MOTOR_CONTACT_FRAMES while the motor is still powered marks this point.
+     * With MOTOR_DEBUG_ADAPT_ONE_WAY the closing run of the adaptation is skipped and motor_contact_position
+     * stays 0 until a move stalls on the seat. valveLearn() ignores 0, so the valve keeps the contact point
+     * stored in the EEPROM, in counts of an earlier full adaptation (the one-way range is MOTOR_MIN_RANGE). */
+    if (motor_direction == DIR_CLOSE && !motor_contact_seen && motor_runtime > MOTOR_SPINUP_FRAMES
+            && motor_timeout == MOTOR_CONTACT_FRAMES && (MOTOR_PORT & (1 << MOTOR_PIN_R))) {
+        motor_contact_position = motor_position;
+        motor_contact_seen = 1;
+    }
     if (motor_position_max) {
         // Already adapted => Check position
         // Calling motorStop() when reaching the exact value is usually enough to stop within +-1 count.
@@ -160,6 +179,11 @@ uint8_t motorAdaptClose(void)
 
     if (motor_runtime <= MOTOR_MAX_RUNTIME_CLOSE) {
         motor_position_max = -motor_position;
+        if (motor_contact_seen) {
+            motor_contact_position -= motor_position;
+        } else {
+            motor_contact_position = 0;
+        }
         motor_position = 0;
         return 1;
     } else {
@@ -224,3 +248,14 @@ int16_t motorGetPosition(void)
 {
     return motor_position;
 }
+
+int16_t motorGetMaxPosition(void)
+{
+    return motor_position_max;
+}
+
+/* Position where the valve seat was last detected while closing. Returns 0 if it is unknown. */
+int16_t motorGetContactPosition(void)
+{
+    return motor_contact_position;
+}
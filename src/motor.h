@@ -11,5 +11,7 @@ void motorAdapt(void);
 uint8_t motorIsAdapted(void);
 void motorSetPosition(int16_t position);
 int16_t motorGetPosition(void);
+int16_t motorGetMaxPosition(void);
+int16_t motorGetContactPosition(void);
 
 #endif /* MOTOR_H_ */
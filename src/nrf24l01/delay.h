@@ -3,8 +3,9 @@
 //This is a helper file to make compile the NRF24L01 driver library without the normally used build files.
 
 
-#include <util/delay.h>
-#define delay_ms _delay_ms
-#define delay_us _delay_us
+#include "clock.h"
+/* The CPU clock changes at run time, see clock.cpp */
+#define delay_ms(ms) clockDelayMs(ms)
+#define delay_us(us) clockDelayUs(us)
 
 #endif
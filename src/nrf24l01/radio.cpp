@@ -4,14 +4,108 @@
 #include "sensor.h"
 #include "ntc.h"
 #include "motor.h"
+#include "motion.h"
+#include "autotune.h"
+#include "preheat.h"
+#include "window.h"
+#include "rtc.h"
+#include "program.h"
+#include "history.h"
+#include "config.h"
+#include "adc.h"
 #include "power.h"
+#include "spi.h"
+#include "clock.h"
 #include "debug.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <avr/wdt.h>
+#include <util/crc16.h>
 
 namespace Radio {
 
-static uint32_t uptime = 0, timestamp = 0; //TODO: Should be implemented using timers
+static uint32_t timestamp = 0;
+/* Values are checked every RADIO_VALUES_S and sent when a field moved by its threshold since the last
+ * report (RADIO_DELTA_* in config.h), but at least every RADIO_HEARTBEAT_S. The module is powered down
+ * in between. After each report it listens for RADIO_LISTEN_MS, the base station sends queued commands
+ * then (see protokoll.txt for the power budget).
+ * The descriptions are sent after boot and when the base station asks for them (debug command 0x6473),
+ * each value packet ends with the schema hash so it can tell whether the descriptions it has cached for
+ * this node still apply.
+ *
+ * Slots: once the base station has set the clock (its SetTime is the beacon), the checks run in the slot
+ * of this node, which follows from its address. Frames of RADIO_SLOTS slots of RADIO_SLOT_S are counted
+ * from Monday 00:00, nodes with different addresses modulo RADIO_SLOTS never transmit at the same time.
+ * Slots are two seconds long, as the clock may be off by a second (see rtcSync()). */
+#define RADIO_VALUES_S (RADIO_SLOTS * RADIO_SLOT_S)
+#define RADIO_SLOT (TINY_UDP_DEFAULT_IP % RADIO_SLOTS)
+typedef char radio_frame_check[RTC_WEEK_SECONDS % RADIO_VALUES_S == 0 ? 1 : -1];
+#define RADIO_LISTEN_TICKS (((uint32_t)RADIO_LISTEN_MS * RTC_TICKS_PER_SECOND + 999) / 1000)
+static uint32_t next_values;
+static uint32_t next_heartbeat;
+static uint8_t polls; /* checks without a report since the last packet */
+static uint8_t descriptions_due = 1;
+static uint16_t schema; /* CRC-CCITT of info_messages */
+
+/* Radio on time: powered up until powered down, the time of a packet is estimated. */
+#define RADIO_POWERUP_MS 2 /* Tpd2stby 1.5 ms */
+#define RADIO_PACKET_MS 1 /* upload, air time and ACK */
+static uint32_t on_ms; /* this hour */
+static uint16_t on_last_hour; /* 10 ms */
+static uint32_t on_hour;
+
+/* Link quality (OBSERVE_TX after each packet), this hour and the last. */
+struct link_quality_t
+{
+    uint16_t packets;
+    uint16_t retries; /* retransmits */
+    uint8_t lost; /* no ACK after all retransmits */
+};
+static link_quality_t link_hour;
+static link_quality_t link_last_hour;
+static uint8_t power; /* RF_PWR 0: -18 dBm, 1: -12 dBm, 2: -6 dBm, 3: 0 dBm */
+static uint8_t power_clean; /* packets in a row without retransmit */
+
+/* Register access for the power down and the link quality, which the driver does not offer (nRF24L01 datasheet) */
+#define RADIO_NRF_R_REGISTER 0x00
+#define RADIO_NRF_W_REGISTER 0x20
+#define RADIO_NRF_CONFIG 0x00
+#define RADIO_NRF_PWR_UP 1
+#define RADIO_NRF_RF_CH 0x05
+#define RADIO_NRF_RF_SETUP 0x06
+#define RADIO_NRF_RF_PWR 1 /* bits 2:1 */
+#define RADIO_NRF_RF_PWR_MAX 3
+#define RADIO_NRF_STATUS 0x07
+#define RADIO_NRF_OBSERVE_TX 0x08
+#define RADIO_NRF_PLOS_CNT 4 /* bits 7:4, lost packets, cleared by writing RF_CH */
+#define RADIO_NRF_ARC_CNT 0x0F /* retransmits of the last packet */
+#define RADIO_NRF_FIFO_STATUS 0x17
+#define RADIO_NRF_RX_EMPTY 0
+#define RADIO_NRF_DYNPD 0x1C
+#define RADIO_NRF_FEATURE 0x1D
+#define RADIO_NRF_EN_DPL 2
+#define RADIO_NRF_EN_ACK_PAY 1
+#define RADIO_NRF_ACTIVATE 0x50 /* nRF24L01 without +: unlocks FEATURE */
+#define RADIO_NRF_NOP 0xFF
+
+/* Events of the IRQ line, bits as in the STATUS register. irq() only notes the edge, the main loop
+ * reads and clears STATUS because the interrupted code may be using the SPI. */
+#define RADIO_EVENT_RX (1 << 6) /* RX_DR */
+#define RADIO_EVENT_TX (1 << 5) /* TX_DS, ACK received */
+#define RADIO_EVENT_MAX_RT (1 << 4) /* no ACK after all retries */
+#define RADIO_EVENT_ALL (RADIO_EVENT_RX | RADIO_EVENT_TX | RADIO_EVENT_MAX_RT)
+static volatile uint8_t irq_pending;
+
+/* Poll: a packet without payload instead of a report, only to pick up the ACK payload of the base station.
+ * The radio listens after it only if the base station flagged more (RADIO_CONTROL_MORE), or always without
+ * RADIO_ACK_PAYLOAD. */
+#define RADIO_POLL_PORT 0x51
+
+/* receiveAckPayload() */
+#define RADIO_ACK_NONE 0 /* nothing came with the ACKs */
+#define RADIO_ACK_DONE 1 /* commands came, the base station has nothing more queued */
+#define RADIO_ACK_MORE 2 /* more is queued for the listen window */
 
 struct sensor_data : public TinyUDP::Packet
 {
@@ -20,8 +114,27 @@ struct sensor_data : public TinyUDP::Packet
     int16_t temperature;
     int16_t valve_position;
     uint8_t battery_voltage;
+    uint16_t moves;
+    uint16_t moves_suppressed;
+    uint16_t motor_counts;
+    int16_t preheat_error;
+    uint8_t window_open;
+    uint8_t window_detections;
+    uint16_t wake_unknown;
+    uint16_t radio_on;
+    uint8_t changed; /* RADIO_CHANGED_*, why this report was sent */
+    int16_t drift;
+    uint16_t retries; /* last hour */
+    uint8_t lost;
+    uint8_t ack_rate; /* % */
+    uint8_t tx_power; /* RF_PWR */
+    uint16_t schema; /* last, so it is found without the descriptions */
 };
 
+/* Control data comes with the ACK of a report (ACK payload, preloaded by the base station) or in the
+ * listen window. RADIO_CONTROL_MORE: the base station has more queued, keep the window open. */
+#define RADIO_CONTROL_MORE _BV(15)
+
 struct control_data : public TinyUDP::Packet
 {
     uint16_t bitmask;
@@ -30,13 +143,46 @@ struct control_data : public TinyUDP::Packet
     uint16_t valve_position;
 };
 
-/* Used to force a reset. */
+/* Used to force a reset, to start autotuning or to send a heat command. */
 struct debug_message : public TinyUDP::Packet
 {
     uint16_t command;
     uint8_t data[6];
 };
 
+/* History download (debug command 0x6873): an info packet, then the ring in full packets, see history.cpp. */
+#define RADIO_HISTORY_PORT 0x48
+#define RADIO_HISTORY_CHUNK 24
+#define RADIO_HISTORY_INFO 0xFFFF
+
+struct history_data : public TinyUDP::Packet
+{
+    uint16_t offset; /* from the oldest byte */
+    uint8_t data[RADIO_HISTORY_CHUNK];
+};
+
+struct history_info : public TinyUDP::Packet
+{
+    uint16_t offset; /* RADIO_HISTORY_INFO */
+    uint16_t size; /* bytes which follow */
+    uint16_t interval; /* seconds per entry */
+    uint16_t age; /* seconds since the newest entry, 0xFFFF: unknown */
+};
+
+/* Weekly program (protokoll.txt, Zeitprogrammierung): debug commands 0x7073 set (data: slot, program_t),
+ * 0x7064 delete (slot), 0x7067 read (slot, RADIO_PROGRAM_ALL: all of them and the rest temperature) and
+ * 0x7274 rest temperature (see program_t). Each is answered with the slots as stored (Zeitprogrammierung
+ * Antwort), so the base station sees whether they were taken. */
+#define RADIO_PROGRAM_PORT 0x50
+#define RADIO_PROGRAM_ALL 0xFF
+#define RADIO_PROGRAM_REST 0xFF /* slot of the rest temperature in answers */
+
+struct program_data : public TinyUDP::Packet
+{
+    program_t program; /* RADIO_PROGRAM_REST: temperature only */
+    uint8_t slot;
+};
+
 const PROGMEM sensor_info info_messages[] = {
      // Max text length: 10                        "0123456789"
      sinfo(0, st_unixtime,    ss_uint32, sc_1,     "Time"),
@@ -44,6 +190,21 @@ const PROGMEM sensor_info info_messages[] = {
      sinfo(2, st_temperature, ss_int16,  sc_0_01,  "Temp"),
      sinfo(3, st_raw,         ss_int16,  sc_1,     "ValveP"),
      sinfo(4, st_voltage,     ss_uint8,  sc_0_1,   "Battery"),
+     sinfo(6, st_raw,         ss_uint16, sc_1,     "Moves"),
+     sinfo(7, st_raw,         ss_uint16, sc_1,     "MovesSupp"),
+     sinfo(8, st_raw,         ss_uint16, sc_1,     "MotorCnt"),
+     sinfo(9, st_raw,         ss_int16,  sc_1,     "PreheatErr"),
+     sinfo(10, st_raw,        ss_uint8,  sc_1,     "WindowOpen"),
+     sinfo(11, st_raw,        ss_uint8,  sc_1,     "WindowCnt"),
+     sinfo(12, st_raw,        ss_uint16, sc_1,     "WakeSpur"),
+     sinfo(13, st_seconds,    ss_uint16, sc_0_01,  "RadioOn/h"),
+     sinfo(14, st_raw,        ss_uint8,  sc_1,     "Changed"),
+     sinfo(16, st_raw,        ss_int16,  sc_1,     "Drift/ppm"),
+     sinfo(17, st_raw,        ss_uint16, sc_1,     "Retries/h"),
+     sinfo(18, st_raw,        ss_uint8,  sc_1,     "Lost/h"),
+     sinfo(19, st_raw,        ss_uint8,  sc_1,     "AckRate"),
+     sinfo(20, st_raw,        ss_uint8,  sc_1,     "TxPower"),
+     sinfo(15, st_raw,        ss_uint16, sc_1,     "Schema"),
 
      // Max text length: 10                                      "0123456789"
      cinfo(0, st_unixtime,    ss_uint32, sc_1,    0, 0xFFFFFFFF, "SetTime"),
@@ -64,32 +225,253 @@ void startListening(void)
     NRF24L01::start_receive();
 }
 
+static uint8_t nrfRegister(uint8_t command, uint8_t value)
+{
+    NRF24L01_PORT_CSN &= ~(1 << NRF24L01_PIN_CSN);
+    SPI::write(command);
+    value = SPI::write(value);
+    NRF24L01_PORT_CSN |= (1 << NRF24L01_PIN_CSN);
+    return value;
+}
+
+static void powerUp(void)
+{
+    uint8_t config = nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_CONFIG, RADIO_NRF_NOP);
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_CONFIG, config | (1 << RADIO_NRF_PWR_UP));
+    uint8_t div = clock_div;
+    clockSlow(); /* nothing to compute while the oscillator starts */
+    clockDelayMs(RADIO_POWERUP_MS);
+    clockSet(div);
+    state = RADIO_IDLE;
+    on_ms += RADIO_POWERUP_MS;
+}
+
+#if RADIO_ACK_PAYLOAD
+/* Dynamic payload length on all pipes and payloads in ACKs, so the base station can answer a report
+ * within the same transaction. */
+static void enableAckPayload(void)
+{
+    uint8_t feature = (1 << RADIO_NRF_EN_DPL) | (1 << RADIO_NRF_EN_ACK_PAY);
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_FEATURE, feature);
+    if (nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_FEATURE, RADIO_NRF_NOP) != feature) {
+        nrfRegister(RADIO_NRF_ACTIVATE, 0x73);
+        nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_FEATURE, feature);
+    }
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_DYNPD, 0x3F);
+}
+#endif
+
+static void setPower(uint8_t level)
+{
+    uint8_t setup = nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_RF_SETUP, RADIO_NRF_NOP);
+    setup = (setup & ~(RADIO_NRF_RF_PWR_MAX << RADIO_NRF_RF_PWR)) | (level << RADIO_NRF_RF_PWR);
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_RF_SETUP, setup);
+    power = level;
+}
+
+/* Counts the retransmits and the loss of the packet just sent and adapts the transmit power: full power
+ * until the link has been clean for RADIO_POWER_CLEAN packets, then one step less. Where the power is too
+ * low, about one packet in RADIO_POWER_CLEAN needs retransmits before the step is taken back. */
+static void observeTx(void)
+{
+    uint8_t observe = nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_OBSERVE_TX, RADIO_NRF_NOP);
+    uint8_t retries = observe & RADIO_NRF_ARC_CNT;
+    uint8_t lost = observe >> RADIO_NRF_PLOS_CNT;
+    link_hour.packets++;
+    link_hour.retries += retries;
+    if (lost) {
+        link_hour.lost = lost > 0xFF - link_hour.lost ? 0xFF : link_hour.lost + lost;
+        nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_RF_CH, NRF24L01_DEFAULT_CHANNEL);
+    }
+    if (lost || retries >= RADIO_POWER_RETRIES) {
+        power_clean = 0;
+        if (power < RADIO_NRF_RF_PWR_MAX) {
+            setPower(power + 1);
+        }
+    } else if (retries) {
+        power_clean = 0;
+    } else if (++power_clean >= RADIO_POWER_CLEAN) {
+        power_clean = 0;
+        if (power > 0) {
+            setPower(power - 1);
+        }
+    }
+}
+
+/* TinyUDP::send() and the sensor helpers poll the nRF until the packet is acknowledged or given up.
+ * As in listen(), the CPU waits at F_CPU: txStart() returns the clock of the caller for txDone(). */
+static uint8_t txStart(void)
+{
+    uint8_t div = clock_div;
+    clockSlow();
+    return div;
+}
+
+static void txDone(uint8_t div)
+{
+    clockSet(div);
+    observeTx();
+    on_ms += RADIO_PACKET_MS;
+}
+
+static void powerDown(void)
+{
+    NRF24L01_PORT_CE &= ~(1 << NRF24L01_PIN_CE);
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_STATUS, RADIO_EVENT_ALL); /* IRQ line high while sleeping */
+    uint8_t config = nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_CONFIG, RADIO_NRF_NOP);
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_CONFIG, config & ~(1 << RADIO_NRF_PWR_UP));
+    state = RADIO_POWERDOWN;
+}
+
 void sendSensorDescriptions()
 {
     for (uint8_t i=0; i<sizeof(info_messages)/sizeof(sensor_info); i++)
     {
+        uint8_t div = txStart();
         send_sensor_info_P(&(info_messages[i]));
+        txDone(div);
+    }
+}
+
+#define RADIO_CHANGED_TEMPERATURE _BV(0)
+#define RADIO_CHANGED_VALVE _BV(1)
+#define RADIO_CHANGED_BATTERY _BV(2)
+#define RADIO_CHANGED_WINDOW _BV(3)
+#define RADIO_CHANGED_PREHEAT _BV(4)
+#define RADIO_CHANGED_HEARTBEAT _BV(7)
+
+static uint8_t differs(int16_t value, int16_t reported, int16_t threshold)
+{
+    return value - reported >= threshold || reported - value >= threshold;
+}
+
+/* Returns the fields which moved by their threshold since the last report (RADIO_CHANGED_*), 0: nothing to send. */
+static uint8_t sensorChanges(uint32_t now)
+{
+    uint8_t changed = 0;
+    if (differs(getNtcTemperature(), sensors.temperature, RADIO_DELTA_TEMPERATURE)) {
+        changed |= RADIO_CHANGED_TEMPERATURE;
+    }
+    if (differs(motorGetPosition(), sensors.valve_position, RADIO_DELTA_VALVE)) {
+        changed |= RADIO_CHANGED_VALVE;
+    }
+    if (differs(getBatteryVoltage() / 100, sensors.battery_voltage, RADIO_DELTA_BATTERY)) {
+        changed |= RADIO_CHANGED_BATTERY;
+    }
+    if (windowIsOpen() != sensors.window_open || window_detections != sensors.window_detections) {
+        changed |= RADIO_CHANGED_WINDOW;
+    }
+    if (preheat_error != sensors.preheat_error) {
+        changed |= RADIO_CHANGED_PREHEAT;
+    }
+    if (now >= next_heartbeat) {
+        changed |= RADIO_CHANGED_HEARTBEAT;
     }
+    return changed;
 }
 
-void sendSensorValues()
+/* Share of the packets which were acknowledged (%), 100 without packets. */
+static uint8_t ackRate(const link_quality_t *link)
+{
+    if (!link->packets) {
+        return 100;
+    }
+    if (link->lost >= link->packets) {
+        return 0;
+    }
+    return (uint32_t)(link->packets - link->lost) * 100 / link->packets;
+}
+
+void sendSensorValues(uint8_t changed)
 {
     sensors.set_payload_size(sizeof(sensor_data) - sizeof(TinyUDP::Packet));
     sensors.flags = 0;
     sensors.timestamp = timestamp;
-    sensors.uptime = uptime;
+    sensors.uptime = rtcGetSeconds();
     sensors.temperature = getNtcTemperature();
     sensors.valve_position = motorGetPosition();
-    sensors.battery_voltage = updateBattery() / 100;
+    sensors.battery_voltage = getBatteryVoltage() / 100;
+    sensors.moves = motion_stats.executed;
+    sensors.moves_suppressed = motion_stats.suppressed;
+    sensors.motor_counts = motion_stats.counts;
+    sensors.preheat_error = preheat_error;
+    sensors.window_open = windowIsOpen();
+    sensors.window_detections = window_detections;
+    sensors.wake_unknown = pwr_wakeups[PWR_WAKE_UNKNOWN];
+    sensors.radio_on = on_last_hour;
+    sensors.changed = changed;
+    sensors.drift = rtcGetDrift();
+    sensors.retries = link_last_hour.retries;
+    sensors.lost = link_last_hour.lost;
+    sensors.ack_rate = ackRate(&link_last_hour);
+    sensors.tx_power = power;
+    sensors.schema = schema;
+    uint8_t div = txStart();
     send_sensor_data(sensors);
-    NRF24L01::start_receive();
+    txDone(div);
+}
+
+void sendHistory()
+{
+    history_data packet;
+    history_info &info = (history_info &)packet;
+    info.port = RADIO_HISTORY_PORT;
+    info.flags = 0;
+    info.set_payload_size(sizeof(history_info) - sizeof(TinyUDP::Packet));
+    info.offset = RADIO_HISTORY_INFO;
+    info.size = HISTORY_SIZE - 1;
+    info.interval = HISTORY_INTERVAL_S;
+    info.age = historyAge();
+    uint8_t div = txStart();
+    TinyUDP::send(packet, sizeof(history_info));
+    txDone(div);
+    for (uint16_t offset = 0;; offset += RADIO_HISTORY_CHUNK) {
+        uint8_t n = historyRead(offset, packet.data, RADIO_HISTORY_CHUNK);
+        if (!n) break;
+        packet.set_payload_size(sizeof(packet.offset) + n);
+        packet.offset = offset;
+        div = txStart();
+        TinyUDP::send(packet, sizeof(TinyUDP::Packet) + sizeof(packet.offset) + n);
+        txDone(div);
+    }
+}
+
+/* Sends a slot as stored, RADIO_PROGRAM_REST the rest temperature. */
+static void sendProgram(uint8_t slot)
+{
+    program_data packet;
+    packet.port = RADIO_PROGRAM_PORT;
+    packet.flags = 0;
+    packet.set_payload_size(sizeof(program_data) - sizeof(TinyUDP::Packet));
+    packet.slot = slot;
+    if (slot == RADIO_PROGRAM_REST) {
+        packet.program.days = 0;
+        packet.program.start = 0;
+        packet.program.end = 0;
+        packet.program.temperature = programGetRest();
+    } else {
+        programGet(slot, &packet.program);
+    }
+    uint8_t div = txStart();
+    TinyUDP::send(packet, sizeof(program_data));
+    txDone(div);
 }
 
+static void sendPoll(void)
+{
+    TinyUDP::Packet packet;
+    packet.port = RADIO_POLL_PORT;
+    packet.flags = 0;
+    packet.set_payload_size(0);
+    uint8_t div = txStart();
+    TinyUDP::send(packet, sizeof(packet));
+    txDone(div);
+}
 
-void receiveControlValues()
+/* Returns 1 if a packet was received. */
+uint8_t receiveControlValues()
 {
-    debugString("Recv\r\n");
-    if (!TinyUDP::receive(controls, sizeof(controls))) return;
+    if (!TinyUDP::receive(controls, sizeof(controls))) return 0;
     debugString("Packet\r\n");
     debugBinary(controls.bitmask);
     debugString("Port");
@@ -103,47 +485,226 @@ void receiveControlValues()
             wdt_enable(WDTO_15MS);
             while (true);
         }
+        if (msg.command == 0x7475) {
+            autotuneStart();
+        }
+        if (msg.command == 0x6862) {
+            /* heat command: temperature, off time (see program_t) */
+            programHeatCommand(msg.data[0], msg.data[1]);
+        }
+        if (msg.command == 0x6873) {
+            sendHistory();
+        }
+        if (msg.command == 0x7072) {
+            pwrDebugPrint();
+        }
+        if (msg.command == 0x6473) {
+            sendSensorDescriptions();
+        }
+        if (msg.command == 0x6d70) {
+            /* motion policy: deadband (counts), minimum interval (seconds) */
+            motionSetPolicy(msg.data[0], msg.data[1] | msg.data[2] << 8);
+        }
+        if (msg.command == 0x7073 && msg.data[0] < PROGRAM_SLOTS) {
+            programSet(msg.data[0], (const program_t *)&msg.data[1]);
+            sendProgram(msg.data[0]);
+        }
+        if (msg.command == 0x7064 && msg.data[0] < PROGRAM_SLOTS) {
+            programClear(msg.data[0]);
+            sendProgram(msg.data[0]);
+        }
+        if (msg.command == 0x7067) {
+            if (msg.data[0] < PROGRAM_SLOTS) {
+                sendProgram(msg.data[0]);
+            } else if (msg.data[0] == RADIO_PROGRAM_ALL) {
+                for (uint8_t i = 0; i < PROGRAM_SLOTS; i++) {
+                    sendProgram(i);
+                }
+                sendProgram(RADIO_PROGRAM_REST);
+            }
+        }
+        if (msg.command == 0x7274) {
+            programSetRest(msg.data[0]);
+            sendProgram(RADIO_PROGRAM_REST);
+        }
     }
     if (controls.port == 0 && (controls.payload_size() == sizeof(control_data) - sizeof(TinyUDP::Packet)))
     {
         if (controls.bitmask & _BV(0)) {
-            //Time
+            //Time: unix time in local time, 1970-01-01 was a Thursday
             timestamp = controls.timestamp;
+            rtcSync(controls.timestamp + 3 * 24 * 3600UL);
+            programReschedule();
         }
         if (controls.bitmask & _BV(1)) {
-            //Temperature
-            //TODO
+            //Temperature: until the program changes it the next time
+            programOverride(controls.temperature, 0);
         }
         if (controls.bitmask & _BV(2)) {
             //Valve
-            motorSetPosition(controls.valve_position);
+            motionRequest(controls.valve_position);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Called by the pin change interrupt on the falling edge of the IRQ line.
+ */
+void irq(void)
+{
+    pwrWake(PWR_WAKE_RADIO);
+    irq_pending = 1;
+}
+
+/* Reads and clears the events of the last IRQ, received packets are handled right away. */
+static uint8_t handleEvents(void)
+{
+    irq_pending = 0;
+    uint8_t events = nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_STATUS, RADIO_NRF_NOP) & RADIO_EVENT_ALL;
+    if (events & RADIO_EVENT_RX) {
+        while (receiveControlValues())
+            ;
+    }
+    if (events & RADIO_EVENT_MAX_RT) {
+        debugString("MaxRT\r\n");
+    }
+    /* clearing all flags releases the IRQ line for the next edge */
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_STATUS, RADIO_EVENT_ALL);
+    return events;
+}
+
+/*
+ * Handles the packets which came with the ACKs of the last packet.
+ * @return RADIO_ACK_NONE, RADIO_ACK_DONE or RADIO_ACK_MORE
+ */
+static uint8_t receiveAckPayload(void)
+{
+    uint8_t received = 0;
+    uint8_t more = 0;
+    while (!(nrfRegister(RADIO_NRF_R_REGISTER | RADIO_NRF_FIFO_STATUS, RADIO_NRF_NOP) & (1 << RADIO_NRF_RX_EMPTY))) {
+        if (!receiveControlValues()) {
+            break;
         }
+        received = 1;
+        if (controls.port == 0 && (controls.bitmask & RADIO_CONTROL_MORE)) {
+            more = 1;
+        }
+    }
+    irq_pending = 0;
+    nrfRegister(RADIO_NRF_W_REGISTER | RADIO_NRF_STATUS, RADIO_EVENT_ALL);
+    return more ? RADIO_ACK_MORE : received ? RADIO_ACK_DONE : RADIO_ACK_NONE;
+}
+
+/* Listens for RADIO_LISTEN_MS after a report, each command received starts the window again.
+ * The CPU sleeps in between, the IRQ line wakes it for a packet. */
+static void listen(void)
+{
+    uint8_t div = clock_div;
+    clockSlow(); /* nothing to compute while waiting */
+    uint32_t start = rtcGetTicks();
+    uint32_t end = start + RADIO_LISTEN_TICKS;
+    startListening();
+    while (rtcGetTicks() < end) {
+        if (irq_pending && (handleEvents() & RADIO_EVENT_RX)) {
+            end = rtcGetTicks() + RADIO_LISTEN_TICKS;
+            startListening();
+        }
+        /* the IRQ after the check above makes sysSleep() return right away */
+        sysSleep(end);
+    }
+    if (irq_pending) {
+        handleEvents();
+    }
+    on_ms += (rtcGetTicks() - start) * 1000 / RTC_TICKS_PER_SECOND;
+    clockSet(div);
+}
+
+/* Moves the radio on time and the link quality of the last hour to the sensor values. */
+static void countOnTime(uint32_t now)
+{
+    if (now / 3600 != on_hour) {
+        on_hour = now / 3600;
+        on_last_hour = on_ms / 10;
+        on_ms = 0;
+        link_last_hour = link_hour;
+        link_hour.packets = 0;
+        link_hour.retries = 0;
+        link_hour.lost = 0;
     }
 }
 
 void init(void)
 {
+    spiAcquire();
     if (NRF24L01::init() != 0) {
         state = RADIO_DISABLED;
-        return;
+    } else {
+        state = RADIO_IDLE;
+        TinyUDP::init();
+#if RADIO_ACK_PAYLOAD
+        enableAckPayload();
+#endif
+        setPower(RADIO_NRF_RF_PWR_MAX);
+        powerDown();
+        schema = 0xFFFF;
+        for (uint16_t i = 0; i < sizeof(info_messages); i++) {
+            schema = _crc_ccitt_update(schema, pgm_read_byte((const uint8_t *)info_messages + i));
+        }
+        PCMSK0 |= (1 << NRF24L01_PIN_IRQ);
     }
-    state = RADIO_IDLE;
-    TinyUDP::init();
-    startListening();
+    spiRelease();
 }
 
-/* This function should be called once per second. */
+/* Returns the start of the next slot of this node, without a clock every RADIO_VALUES_S from now. */
+static uint32_t nextSlot(uint32_t now)
+{
+    uint32_t week = rtcGetWeekTime();
+    if (week == RTC_NEVER) {
+        return now + RADIO_VALUES_S;
+    }
+    uint32_t ahead = (RADIO_SLOT * RADIO_SLOT_S + RADIO_VALUES_S - week % RADIO_VALUES_S) % RADIO_VALUES_S;
+    return now + (ahead ? ahead : RADIO_VALUES_S);
+}
+
+/* This function should be called once nextRun() is reached. */
 void periodic(void)
 {
-    //TODO: Transmit in fixed intervals (=> Register timer callback)
     if (state == RADIO_DISABLED) return;
-    uptime++;
-    if ((uptime & 7) == 0) {
-        sendSensorDescriptions();
+    uint32_t now = rtcGetSeconds();
+    if (now < nextRun()) return;
+    next_values = nextSlot(now);
+    countOnTime(now);
+    uint8_t changed = sensorChanges(now);
+    if (!changed && ++polls < RADIO_POLL_CHECKS) return;
+    polls = 0;
+    spiAcquire();
+    powerUp();
+    if (changed) {
+        next_heartbeat = now + RADIO_HEARTBEAT_S;
+        if (descriptions_due) {
+            descriptions_due = 0;
+            sendSensorDescriptions();
+        }
+        sendSensorValues(changed);
+    } else {
+        sendPoll();
     }
-    if ((uptime & 3) == 0) {
-        sendSensorValues();
+    /* a report gets the window unless the ACK said it is done, a poll only if more is queued (without ACK
+     * payloads always) */
+    uint8_t ack = receiveAckPayload();
+    if (ack == RADIO_ACK_MORE || (ack == RADIO_ACK_NONE && (changed || !RADIO_ACK_PAYLOAD))) {
+        listen();
     }
-    receiveControlValues();
+    powerDown();
+    spiRelease();
+    next_values = nextSlot(rtcGetSeconds()); /* the clock may have been set */
+}
+
+/* Returns when periodic() has to run next (rtc seconds). */
+uint32_t nextRun(void)
+{
+    if (state == RADIO_DISABLED) return RTC_NEVER;
+    return next_values;
 }
 } //ns Radio
@@ -3,6 +3,7 @@
 #include "adc.h"
 #include "config.h"
 #include "debug.h"
+#include "window.h"
 
 /* all resistances in 10 Ohms */
 #define VOLTAGE_DIVIDER_RES 1200000000UL
@@ -65,4 +66,5 @@ void updateNtcTemperature(void)
     temperature = NTC_START_DEGREE + i * (uint32_t)NTC_DEGREE_STEPS
             - (((ntcRes - ntcResTbl) * (uint32_t)NTC_DEGREE_STEPS) / (pgm_read_word(&NtcRes[i-1]) - ntcResTbl));
     Temperature = temperature - NTCOffset;
+    windowUpdate(Temperature);
 }
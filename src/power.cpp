@@ -2,60 +2,150 @@
 #include "config.h"
 #include "lcd.h"
 #include "adc.h"
+#include "store.h"
+#include "rtc.h"
+#include "debug.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/sleep.h>
 
 #define ADC_CH_REF 30
 #define ADC_REF_MV 1100
 uint16_t BatteryMV; // battery volage in mV
 
+/* Peripheral power: each PRR block is clocked only while at least one user holds it (pwrAcquire()).
+ * Blocks lose their configuration when they are powered down, users set them up again when pwrAcquire()
+ * returns 1. */
+#define PWR_BLOCKS 5 /* PRADC ... PRLCD */
+#define PWR_ALL ((1 << PRADC) | (1 << PRUSART0) | (1 << PRSPI) | (1 << PRTIM1) | (1 << PRLCD))
+static uint8_t pwr_users[PWR_BLOCKS];
+
+volatile uint8_t pwr_wake_source = PWR_WAKE_NONE;
+uint16_t pwr_wakeups[PWR_WAKE_SOURCES]; /* per source, see sysSleep() */
+
 void pwrInit(void)
 {
-#if DEBUG_ENABLED
-    PRR = (1 << PRTIM1); // disable some hardware
-#else
-    PRR = (1 << PRTIM1) | (1 << PRUSART0); // disable some hardware
-#endif
+    PRR = PWR_ALL;
+    ACSR = (1 << ACD); /* analog comparator */
+    DIDR1 = (1 << AIN0D); /* PE2 is an output */
+    /* defined levels for pins which would float */
+    PORTB |= UNUSED_PINS_B;
+    PORTE |= UNUSED_PINS_E;
+    PORTF |= UNUSED_PINS_F;
     set_sleep_mode(SLEEP_MODE_PWR_SAVE);
     PCMSK0 |= (1 << POWERLOSS_PIN); /* emergency power loss IRQ */
     POWERLOSS_DDR &= ~(1 << POWERLOSS_PIN);
     EIMSK |= (1 << PCIE0);
 }
 
-/* Put system into low power mode. */
-void sysSleep(void)
+/**
+ * Put system into low power mode until the given rtcGetTicks() or an earlier interrupt.
+ * Power save with the brown out detector switched off by software (BODS), it is back on after the
+ * wake-up (~60 us later). The ADC is powered down by getAdc() already, digital inputs are clamped
+ * in power save except for the pin change interrupts.
+ * Deadline and interrupts are checked with interrupts disabled: if the deadline passed or an interrupt
+ * came since the last return (e.g. the radio IRQ while the caller looked at its flags), it returns
+ * without sleeping. An interrupt from the cli() on wakes the CPU right after sleep_cpu().
+ * Counts the wake-ups per source, PWR_WAKE_UNKNOWN if no interrupt claimed it.
+ */
+void sysSleep(uint32_t tick)
 {
-    OCR2A = 0; //TODO
-    ADCSRA &= ~(1 << ADEN); // Disable ADC
-    displaySymbols(LCD_BATTERY, LCD_BATTERY); //TODO: For debugging only
+    rtcWakeAtTick(tick);
     while (ASSR & (1 << OCR2UB))
         /* wait at least one asynchronous clock cycle for interrupt logic to reset */
         ;
-    sleep_mode();
-    displaySymbols(LCD_NONE, LCD_BATTERY);
+    cli();
+    if (pwr_wake_source == PWR_WAKE_NONE && rtcGetTicks() < tick) {
+        sleep_enable();
+        sleep_bod_disable();
+        sei(); /* the next instruction is executed before any interrupt */
+        sleep_cpu();
+        sleep_disable();
+        cli();
+        pwr_wakeups[pwr_wake_source == PWR_WAKE_NONE ? PWR_WAKE_UNKNOWN : pwr_wake_source]++;
+    }
+    pwr_wake_source = PWR_WAKE_NONE;
+    sei();
 }
 
-/// \brief Disable hardware and save data to non-volatile memory on battery removal.
+/* Measure the shutdown steps with timer 1 (8 us ticks) and print them on the debug UART instead of
+ * shutting down. For bench tests with the power loss pin pulled while the supply stays on. */
+//#define POWER_DEBUG_SHUTDOWN
+
+/* The hold-up capacitor has to last until the shutdown record is written, after a main loop EEPROM write
+ * which may be in progress (1 ms for the code around it). */
+typedef char power_budget_check[(STORE_SHUTDOWN_BYTES + 1) * EEPROM_WRITE_US + 1000 <= POWERLOSS_BUDGET_US ? 1 : -1];
+
+/**
+ * \brief Disable hardware and save data to non-volatile memory on battery removal.
+ *
+ * Timing budget: C8 (100 uF) supplies the controller and the motor after the battery is gone. With ~1 V
+ * until the brown out and ~3 mA while writing the EEPROM it lasts POWERLOSS_BUDGET_US (30 ms).
+ * - storeShutdownStart(): the record is pre-serialised, only time and CRC are filled in (< 0.2 ms),
+ *   then the first EEPROM byte write starts.
+ * - motor and radio (CE) are cut during that write, they would drain the capacitor within milliseconds.
+ * - the rest of the record: at most (STORE_SHUTDOWN_BYTES + 1) * EEPROM_WRITE_US (23.8 ms) from the edge,
+ *   the first write may have to wait for one of the main loop.
+ * - EEAR and EEDR are restored and the EEPROM is idle on return, so an eeprom_update_*() of the main loop
+ *   that was interrupted between its register writes goes on with its own address and data.
+ * - lcdOff() waits up to two LCD frames (31 ms), so it comes after the record. If the voltage is
+ *   gone before, nothing is lost.
+ */
 void sysShutdown(void)
 {
+#ifdef POWER_DEBUG_SHUTDOWN
+    uint16_t ticks[3];
+    pwrAcquire(PRTIM1);
+    TCNT1 = 0;
+    TCCR1B = (1 << CS11);
+#endif
+    uint16_t eear = EEAR;
+    uint8_t eedr = EEDR;
+    // time and temperature set-point, other settings are saved when edited
+    storeShutdownStart();
+
+    // E: motor, F: radio CE/CSN, NTC
+    PORTE = 0;
+    DDRE = 0;
+    PORTF = 0;
+    DDRF = 0;
+
     // ADC
     ADCSRA = 0;
 
-    // A, C, D, G: LCD
+    // B: keys, SPI
     DDRB = 0;
     PORTB = 0;
+#ifdef POWER_DEBUG_SHUTDOWN
+    ticks[0] = TCNT1;
+#endif
 
-    DDRE = 0;
-    PORTE = 0;
-
-    DDRF = 0;
-    PORTF = 0;
+    while (storeShutdownStep())
+        ;
+    EEAR = eear;
+    EEDR = eedr;
+#ifdef POWER_DEBUG_SHUTDOWN
+    ticks[1] = TCNT1;
+#endif
 
+    // A, C, D, G: LCD
     lcdOff();
+#ifdef POWER_DEBUG_SHUTDOWN
+    ticks[2] = TCNT1;
+    DDRE |= (1 << PE1); /* UART TX */
+    debugString("Shutdown 8us ticks: ports ");
+    debugNumber(ticks[0]);
+    debugString("eeprom ");
+    debugNumber(ticks[1]);
+    debugString("lcd ");
+    debugNumber(ticks[2]);
+    pwrRelease(PRTIM1);
+    return;
+#endif
 
-    // shut down everything else
-    PRR = (1 << PRLCD) | (1 << PRTIM1) | (1 << PRSPI) | (1 << PRUSART0) | (1 << PRADC);
+    // shut down everything else, regardless of users
+    PRR = PWR_ALL;
 
     //TODO: Make sure no pins are floating
     DDRA = 0;
@@ -69,11 +159,57 @@ void sysShutdown(void)
 
     DDRG = 0;
     PORTG = 0;
+}
+
+/**
+ * Powers a block up for one more user.
+ * @param block PRR bit (PRADC, PRUSART0, PRSPI, PRTIM1, PRLCD)
+ * @return 1 if it was powered down before and has to be set up
+ */
+uint8_t pwrAcquire(uint8_t block)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t up = !pwr_users[block]++;
+    PRR &= ~(1 << block);
+    SREG = sreg;
+    return up;
+}
+
+/** Powers a block down once the last user released it. */
+void pwrRelease(uint8_t block)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (pwr_users[block] && !--pwr_users[block]) {
+        PRR |= 1 << block;
+    }
+    SREG = sreg;
+}
 
-    // TODO: write data to EEPROM
-    // time
-    // temperature set-point
-    // other settings should be saved when edited
+/**
+ * Lists the powered blocks and their users on the debug UART (which is one of them while printing)
+ * and the wake-ups per source.
+ */
+void pwrDebugPrint(void)
+{
+#if DEBUG_ENABLED
+    static const char *const names[PWR_BLOCKS] = { "ADC ", "USART ", "SPI ", "Timer1 ", "LCD " };
+    static const char *const sources[PWR_WAKE_SOURCES] = { "RTC ", "Alarm ", "Key ", "Motor ", "Power loss ",
+            "Radio ", "LCD ", "Unknown " };
+    debugString("Powered:\r\n");
+    for (uint8_t i = 0; i < PWR_BLOCKS; i++) {
+        if (!(PRR & (1 << i))) {
+            debugString(names[i]);
+            debugNumber(pwr_users[i]);
+        }
+    }
+    debugString("Wake-ups:\r\n");
+    for (uint8_t i = 0; i < PWR_WAKE_SOURCES; i++) {
+        debugString(sources[i]);
+        debugNumber(pwr_wakeups[i]);
+    }
+#endif
 }
 
 uint16_t updateBattery(void)
@@ -2,9 +2,30 @@
 #define POWER_H_
 #include <stdint.h>
 
+/* Wake-up sources, the first interrupt after sysSleep() reports its source with pwrWake(), an interrupt
+ * before the next sysSleep() makes it return right away */
+#define PWR_WAKE_RTC 0 /* timer 2 overflow */
+#define PWR_WAKE_ALARM 1 /* timer 2 compare, rtcWakeAt() */
+#define PWR_WAKE_KEY 2
+#define PWR_WAKE_MOTOR 3
+#define PWR_WAKE_POWERLOSS 4
+#define PWR_WAKE_RADIO 5
+#define PWR_WAKE_LCD 6
+#define PWR_WAKE_UNKNOWN 7 /* none of the above, i.e. spurious */
+#define PWR_WAKE_SOURCES 8
+#define PWR_WAKE_NONE 0xFF
+
+extern volatile uint8_t pwr_wake_source;
+extern uint16_t pwr_wakeups[PWR_WAKE_SOURCES];
+
+#define pwrWake(source) do { if (pwr_wake_source == PWR_WAKE_NONE) pwr_wake_source = (source); } while (0)
+
 void pwrInit(void);
-void sysSleep(void);
+void sysSleep(uint32_t tick);
 void sysShutdown(void);
 uint16_t updateBattery(void);
+uint8_t pwrAcquire(uint8_t block);
+void pwrRelease(uint8_t block);
+void pwrDebugPrint(void);
 
 #endif /* POWER_H_ */
@@ -0,0 +1,136 @@
+#include <avr/eeprom.h>
+
+#include "preheat.h"
+#include "control.h"
+#include "ntc.h"
+#include "rtc.h"
+#include "debug.h"
+
+/* Heat-up model
+ *
+ * The time to heat up by dT is modelled as t = a + b * dT (a: dead time in minutes, b: minutes per K).
+ * Each completed heat-up is a sample (dT, t) which updates a and b by a normalised LMS step:
+ *   err = t - (a + b * dT)
+ *   a += mu * err / (1 + dT^2)
+ *   b += mu * err * dT / (1 + dT^2)
+ * with dT in K and mu = 1/2. In the code dT is in 0.01 K and b is scaled by 16.
+ */
+#define PREHEAT_VERSION 1
+#define PREHEAT_DEFAULT_A 30 /* minutes */
+#define PREHEAT_DEFAULT_B16 (60 * 16) /* 1 hour per K */
+#define PREHEAT_BAND 20 /* 0.01 K, target counts as reached within this */
+#define PREHEAT_MAX_LEAD 360 /* minutes */
+#define PREHEAT_MAX_ERROR 255 /* minutes, larger errors are limited for learning */
+
+struct preheat_model_t
+{
+    uint8_t version;
+    uint8_t a;
+    uint16_t b16;
+};
+
+static preheat_model_t EEMEM preheat_eemodel;
+static preheat_model_t preheat_model;
+
+int16_t preheat_error;
+
+static uint32_t preheat_at; /* scheduled time, 0: nothing scheduled */
+static int16_t preheat_target;
+static uint32_t preheat_start; /* 0: not heating */
+static int16_t preheat_from;
+
+void preheatInit(void)
+{
+    eeprom_read_block(&preheat_model, &preheat_eemodel, sizeof(preheat_model));
+    if (preheat_model.version != PREHEAT_VERSION) {
+        preheat_model.version = PREHEAT_VERSION;
+        preheat_model.a = PREHEAT_DEFAULT_A;
+        preheat_model.b16 = PREHEAT_DEFAULT_B16;
+    }
+}
+
+/** Predicted time in minutes to heat up from one temperature to another. */
+uint16_t preheatLeadTime(int16_t from, int16_t to)
+{
+    if (to <= from) {
+        return 0;
+    }
+    uint32_t lead = preheat_model.a + (uint32_t)preheat_model.b16 * (uint16_t)(to - from) / 1600;
+    return lead > PREHEAT_MAX_LEAD ? PREHEAT_MAX_LEAD : lead;
+}
+
+static void preheatLearn(uint16_t dt, uint16_t minutes)
+{
+    int16_t err = minutes - preheatLeadTime(0, dt);
+    if (err > PREHEAT_MAX_ERROR) {
+        err = PREHEAT_MAX_ERROR;
+    } else if (err < -PREHEAT_MAX_ERROR) {
+        err = -PREHEAT_MAX_ERROR;
+    }
+    int32_t den = 2 * (10000 + (int32_t)dt * dt);
+    int16_t a = preheat_model.a + (int32_t)err * 10000 / den;
+    int32_t b16 = preheat_model.b16 + (int32_t)err * dt * 1600 / den;
+    preheat_model.a = a < 0 ? 0 : (a > 255 ? 255 : a);
+    preheat_model.b16 = b16 < 16 ? 16 : (b16 > 65535 ? 65535 : b16);
+    eeprom_update_block(&preheat_model, &preheat_eemodel, sizeof(preheat_model));
+}
+
+/**
+ * Announces the next setpoint change.
+ * @param at time of the change (rtcGetSeconds())
+ * @param temperature new nominal temperature. Falling setpoints are ignored.
+ */
+void preheatSchedule(uint32_t at, int16_t temperature)
+{
+    preheat_at = at;
+    preheat_target = temperature;
+}
+
+/* Should be called from the main loop. Starts heating early (see preheatNextRun()) and learns from the result. */
+void preheatPeriodic(void)
+{
+    uint32_t now = rtcGetSeconds();
+    int16_t t = getNtcTemperature();
+
+    if (preheat_start) {
+        if (t >= preheat_target - PREHEAT_BAND) {
+            int32_t error = ((int32_t)now - (int32_t)preheat_at) / 60;
+            preheat_error = error > 32767 ? 32767 : (error < -32767 ? -32767 : error);
+            preheatLearn(preheat_target - preheat_from, (now - preheat_start) / 60);
+            debugString("Preheat error ");
+            debugNumber(preheat_error);
+            preheat_start = 0;
+            preheat_at = 0;
+        } else if (getNominalTemperature() != preheat_target) {
+            /* Someone else changed the setpoint, the sample is useless. */
+            preheat_start = 0;
+        }
+        return;
+    }
+    if (!preheat_at || preheat_target <= getNominalTemperature()) {
+        return;
+    }
+    if (now >= preheat_at && t >= preheat_target - PREHEAT_BAND) {
+        /* Still warm enough, nothing to learn. */
+        preheat_at = 0;
+        return;
+    }
+    if (now + 60UL * preheatLeadTime(t, preheat_target) >= preheat_at) {
+        preheat_from = t;
+        preheat_start = now;
+        setNominalTemperature(preheat_target);
+    }
+}
+
+/**
+ * Returns when preheatPeriodic() has to start the scheduled heat-up (rtc seconds), by the lead time for
+ * the current temperature. While heating the arrival is checked in each pass, RTC_NEVER for that.
+ */
+uint32_t preheatNextRun(void)
+{
+    if (preheat_start || !preheat_at || preheat_target <= getNominalTemperature()) {
+        return RTC_NEVER;
+    }
+    uint32_t lead = 60UL * preheatLeadTime(getNtcTemperature(), preheat_target);
+    return preheat_at > lead ? preheat_at - lead : 0;
+}
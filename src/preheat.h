@@ -0,0 +1,15 @@
+/* Optimum start: Begin heating just early enough to reach the next setpoint in time. */
+#ifndef PREHEAT_H_
+#define PREHEAT_H_
+#include <stdint.h>
+
+void preheatInit(void);
+void preheatSchedule(uint32_t at, int16_t temperature);
+void preheatPeriodic(void);
+uint32_t preheatNextRun(void);
+uint16_t preheatLeadTime(int16_t from, int16_t to);
+
+/* Arrival time minus scheduled time of the last preheat in minutes (negative: early). */
+extern int16_t preheat_error;
+
+#endif /* PREHEAT_H_ */
@@ -0,0 +1,372 @@
+#include <avr/eeprom.h>
+
+#include "program.h"
+#include "control.h"
+#include "preheat.h"
+#include "rtc.h"
+#include "config.h"
+#include "debug.h"
+
+/* Program selection
+ *
+ * Times are handled in units of 7.5 minutes since Monday 00:00. The time byte of a slot already is
+ * the unit within its day (hour * 8 + eighth).
+ * A slot is active from its start to its end on each of its days. If several slots are active,
+ * the one with the lowest number wins. Without an active slot the rest temperature is set.
+ * The program only sets the nominal temperature at transitions, so manual changes stay until the
+ * next one. Nothing is done until the clock was set and at least one slot is programmed.
+ *
+ * Overrides (boost, heat command, radio) replace the program temperature until they expire.
+ * The expiry is part of the next transition, so they do not need extra wakeups.
+ *
+ * A one-shot slot is deleted when the program passes one of its ends, also if it was not seen starting
+ * (reset while it ran). Forward jumps of the clock (set after a reset) count as passed, backward ones
+ * (less than half a week) do not.
+ * The slots are kept in RAM as well, finding the next change evaluates all of them at each boundary.
+ */
+#define PROGRAM_VERSION 1
+#define PROGRAM_UNIT_S 450
+#define PROGRAM_DAY_UNITS 192
+#define PROGRAM_WEEK_UNITS (7 * PROGRAM_DAY_UNITS)
+#define PROGRAM_DEFAULT_REST (17 * 4) /* 17 degC */
+#define PROGRAM_REST 0xFF /* pseudo slot for the rest temperature */
+#define PROGRAM_UNKNOWN 0xFE /* nothing applied yet */
+#define PROGRAM_NO_UNIT 0xFFFF
+
+struct program_config_t
+{
+    uint8_t version;
+    uint8_t rest;
+    program_t slots[PROGRAM_SLOTS];
+};
+
+static program_config_t EEMEM program_eeconfig;
+
+static program_t program_slots[PROGRAM_SLOTS]; /* copy of program_eeconfig.slots */
+static uint8_t program_rest;
+static uint8_t program_slot = PROGRAM_UNKNOWN; /* slot applied last */
+static uint8_t program_temperature; /* temperature applied last */
+static uint16_t program_unit = PROGRAM_NO_UNIT; /* unit evaluated last, for the ends of one-shot slots */
+static uint16_t program_stored; /* slots stored since then, an end before they were stored does not count */
+static uint32_t program_next; /* rtcGetSeconds() of the next transition, RTC_NEVER: none */
+static uint32_t program_override_until; /* rtcGetSeconds(), 0: no override, RTC_NEVER: for good */
+static int16_t program_override_restore; /* nominal temperature before the override */
+
+void programInit(void)
+{
+    program_rest = eeprom_read_byte(&program_eeconfig.rest);
+    if (eeprom_read_byte(&program_eeconfig.version) != PROGRAM_VERSION) {
+        program_t empty = { 0, 0, 0, 0 };
+        for (uint8_t i = 0; i < PROGRAM_SLOTS; i++) {
+            eeprom_update_block(&empty, &program_eeconfig.slots[i], sizeof(empty));
+        }
+        program_rest = PROGRAM_DEFAULT_REST;
+        eeprom_update_byte(&program_eeconfig.rest, program_rest);
+        eeprom_update_byte(&program_eeconfig.version, PROGRAM_VERSION);
+    }
+    eeprom_read_block(program_slots, program_eeconfig.slots, sizeof(program_slots));
+}
+
+/**
+ * Stores a slot.
+ * @param program NULL deletes the slot
+ * @return 0 on success, 1 if slot or times are invalid
+ */
+uint8_t programSet(uint8_t slot, const program_t *program)
+{
+    program_t p = { 0, 0, 0, 0 };
+    if (slot >= PROGRAM_SLOTS) {
+        return 1;
+    }
+    if (program) {
+        p = *program;
+        if (!(p.days & PROGRAM_DAYS) || p.start >= PROGRAM_DAY_UNITS || p.end > PROGRAM_DAY_UNITS) {
+            return 1;
+        }
+    }
+    eeprom_update_block(&p, &program_eeconfig.slots[slot], sizeof(p));
+    program_slots[slot] = p;
+    program_stored |= 1 << slot;
+    programReschedule();
+    return 0;
+}
+
+void programGet(uint8_t slot, program_t *program)
+{
+    *program = program_slots[slot];
+}
+
+/** Sets the temperature used while no slot is active. */
+void programSetRest(uint8_t temperature)
+{
+    program_rest = temperature;
+    eeprom_update_byte(&program_eeconfig.rest, temperature);
+    programReschedule();
+}
+
+uint8_t programGetRest(void)
+{
+    return program_rest;
+}
+
+/** Evaluates the program again at the next call of programPeriodic(), e.g. after setting the clock. */
+void programReschedule(void)
+{
+    program_next = 0;
+}
+
+static uint8_t programLength(const program_t *p)
+{
+    return p->end > p->start ? p->end - p->start : p->end + PROGRAM_DAY_UNITS - p->start;
+}
+
+/* Returns 1 if the slot is active at unit u. */
+static uint8_t programIsActive(const program_t *p, uint16_t u)
+{
+    for (uint8_t d = 0; d < 7; d++) {
+        if (p->days & (1 << d)) {
+            uint16_t since = (u + PROGRAM_WEEK_UNITS - (d * PROGRAM_DAY_UNITS + p->start)) % PROGRAM_WEEK_UNITS;
+            if (since < programLength(p)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Units from u to the next start or end of any slot, 0: no slots at all. */
+static uint16_t programNextBoundary(uint16_t u)
+{
+    uint16_t next = 0;
+    for (uint8_t i = 0; i < PROGRAM_SLOTS; i++) {
+        const program_t *p = &program_slots[i];
+        for (uint8_t d = 0; d < 7; d++) {
+            if (!(p->days & (1 << d))) {
+                continue;
+            }
+            uint16_t start = d * PROGRAM_DAY_UNITS + p->start;
+            uint16_t b[2] = { start, (uint16_t)(start + programLength(p)) };
+            for (uint8_t j = 0; j < 2; j++) {
+                uint16_t dist = (b[j] + PROGRAM_WEEK_UNITS - u) % PROGRAM_WEEK_UNITS;
+                if (!dist) {
+                    dist = PROGRAM_WEEK_UNITS;
+                }
+                if (!next || dist < next) {
+                    next = dist;
+                }
+            }
+        }
+    }
+    return next;
+}
+
+/* Returns 1 if one of the ends of the slot lies after unit from, up to and including unit to. */
+static uint8_t programHasEnded(const program_t *p, uint16_t from, uint16_t to)
+{
+    uint16_t passed = (to + PROGRAM_WEEK_UNITS - from) % PROGRAM_WEEK_UNITS;
+    if (passed > PROGRAM_WEEK_UNITS / 2) {
+        return 0; /* the clock went back */
+    }
+    for (uint8_t d = 0; d < 7; d++) {
+        if (p->days & (1 << d)) {
+            uint16_t end = (d * PROGRAM_DAY_UNITS + p->start + programLength(p)) % PROGRAM_WEEK_UNITS;
+            uint16_t since = (to + PROGRAM_WEEK_UNITS - end) % PROGRAM_WEEK_UNITS;
+            if (since < passed) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the temperature at unit u and the slot it comes from.
+ * @param cleanup delete one-shot slots which ended since the last cleanup
+ */
+static uint8_t programEvaluate(uint16_t u, uint8_t *slot, uint8_t cleanup)
+{
+    uint8_t temperature = program_rest;
+    uint16_t last = program_unit == PROGRAM_NO_UNIT ? (u + PROGRAM_WEEK_UNITS - 1) % PROGRAM_WEEK_UNITS : program_unit;
+    *slot = PROGRAM_REST;
+    for (uint8_t i = 0; i < PROGRAM_SLOTS; i++) {
+        const program_t *p = &program_slots[i];
+        if (!(p->days & PROGRAM_DAYS)) {
+            continue;
+        }
+        if (cleanup && (p->days & PROGRAM_ONCE) && !(program_stored & (1 << i)) && programHasEnded(p, last, u)) {
+            debugString("Program done ");
+            debugNumber(i);
+            programSet(i, 0);
+            continue;
+        }
+        if (*slot == PROGRAM_REST && programIsActive(p, u)) {
+            *slot = i;
+            temperature = p->temperature;
+        }
+    }
+    if (cleanup) {
+        program_unit = u;
+        program_stored = 0;
+    }
+    return temperature;
+}
+
+/*
+ * Units from u to the next change of the temperature, boundaries of overruled slots do not change it.
+ * @param temperature temperature at u, returns the one after the change
+ * @return 0 if it never changes
+ */
+static uint16_t programNextChange(uint16_t u, uint8_t *temperature)
+{
+    uint16_t ahead = 0;
+    uint16_t next = programNextBoundary(u);
+    uint8_t slot;
+    while (next && ahead + next < PROGRAM_WEEK_UNITS) {
+        ahead += next;
+        u = (u + next) % PROGRAM_WEEK_UNITS;
+        uint8_t t = programEvaluate(u, &slot, 0);
+        if (t != *temperature) {
+            *temperature = t;
+            return ahead;
+        }
+        next = programNextBoundary(u);
+    }
+    return 0;
+}
+
+/**
+ * Applies the program at its transitions and ends overrides. Should be called from the main loop,
+ * programNextRun() tells when it has something to do.
+ */
+void programPeriodic(void)
+{
+    uint32_t now = rtcGetSeconds();
+    uint32_t week = rtcGetWeekTime();
+    uint8_t slot = PROGRAM_UNKNOWN;
+    uint8_t temperature = 0;
+    uint32_t unit_start = now - week % PROGRAM_UNIT_S;
+    uint16_t u = week / PROGRAM_UNIT_S;
+    if (now < program_next) {
+        return;
+    }
+    program_next = RTC_NEVER;
+    if (week != RTC_NEVER) {
+        temperature = programEvaluate(u, &slot, 1);
+        uint16_t next = programNextBoundary(u);
+        if (next) {
+            program_next = unit_start + (uint32_t)next * PROGRAM_UNIT_S;
+        } else {
+            /* empty program */
+            slot = PROGRAM_UNKNOWN;
+        }
+    }
+
+    if (program_override_until) {
+        if (now < program_override_until) {
+            if (program_override_until < program_next) {
+                program_next = program_override_until;
+            }
+            return;
+        }
+        program_override_until = 0;
+        program_slot = PROGRAM_UNKNOWN;
+        if (slot == PROGRAM_UNKNOWN) {
+            setNominalTemperature(program_override_restore);
+        }
+    }
+    if (slot == PROGRAM_UNKNOWN) {
+        return;
+    }
+
+    if (slot != program_slot || temperature != program_temperature) {
+        program_slot = slot;
+        program_temperature = temperature;
+        setNominalTemperature(PROGRAM_TEMPERATURE(temperature));
+    }
+
+    uint8_t next_temperature = temperature;
+    uint16_t ahead = programNextChange(u, &next_temperature);
+    if (ahead && next_temperature > temperature) {
+        preheatSchedule(unit_start + (uint32_t)ahead * PROGRAM_UNIT_S, PROGRAM_TEMPERATURE(next_temperature));
+    }
+}
+
+/**
+ * Overrides the program with a fixed temperature.
+ * @param temperature 0.01 degC
+ * @param duration seconds, 0: until the program changes the temperature the next time
+ *                 (for good if there is no program)
+ */
+void programOverride(int16_t temperature, uint32_t duration)
+{
+    uint32_t now = rtcGetSeconds();
+    uint32_t week = rtcGetWeekTime();
+    if (!program_override_until) {
+        program_override_restore = getNominalTemperature();
+    }
+    if (duration) {
+        program_override_until = now + duration;
+    } else {
+        uint16_t ahead = 0;
+        uint8_t slot;
+        if (week != RTC_NEVER) {
+            uint8_t t = programEvaluate(week / PROGRAM_UNIT_S, &slot, 0);
+            ahead = programNextChange(week / PROGRAM_UNIT_S, &t);
+        }
+        program_override_until = ahead ?
+                now - week % PROGRAM_UNIT_S + (uint32_t)ahead * PROGRAM_UNIT_S : RTC_NEVER;
+    }
+    setNominalTemperature(temperature);
+    programReschedule();
+}
+
+/** Ends an override, the program (or the temperature before the override) applies again. */
+void programCancelOverride(void)
+{
+    if (program_override_until) {
+        program_override_until = rtcGetSeconds();
+        programReschedule();
+    }
+}
+
+/** Heat now: PROGRAM_BOOST_TEMPERATURE for PROGRAM_BOOST_S. Cancels a running override instead. */
+void programBoost(void)
+{
+    if (program_override_until) {
+        programCancelOverride();
+    } else {
+        programOverride(PROGRAM_BOOST_TEMPERATURE, PROGRAM_BOOST_S);
+    }
+}
+
+/**
+ * Heat command from protokoll.txt (Heizbefehl).
+ * @param temperature see program_t
+ * @param off time to return to the program (see program_t), hour 24: keep the temperature
+ *            until the program changes it
+ * @return 0 on success, 1 if the time is invalid or the clock is not set
+ */
+uint8_t programHeatCommand(uint8_t temperature, uint8_t off)
+{
+    uint32_t week = rtcGetWeekTime();
+    if (off >> 3 == 24) {
+        programOverride(PROGRAM_TEMPERATURE(temperature), 0);
+        return 0;
+    }
+    if (off >= PROGRAM_DAY_UNITS || week == RTC_NEVER) {
+        return 1;
+    }
+    uint32_t day = week % (24 * 3600UL);
+    uint32_t at = (uint32_t)off * PROGRAM_UNIT_S;
+    programOverride(PROGRAM_TEMPERATURE(temperature), at > day ? at - day : at + 24 * 3600UL - day);
+    return 0;
+}
+
+/** Returns when programPeriodic() has to run next (rtc seconds). */
+uint32_t programNextRun(void)
+{
+    if (rtcGetWeekTime() == RTC_NEVER && !program_override_until) {
+        return RTC_NEVER;
+    }
+    return program_next;
+}
@@ -0,0 +1,40 @@
+/* Weekly heating program, see protokoll.txt (Zeitprogrammierung). */
+#ifndef PROGRAM_H_
+#define PROGRAM_H_
+#include <stdint.h>
+
+#define PROGRAM_SLOTS 16
+
+/* days: bit 0 Monday ... bit 6 Sunday */
+#define PROGRAM_ONCE 0x80 /* slot is deleted after it ran once */
+#define PROGRAM_DAYS 0x7F
+
+/* Times: 5 bit hour, 3 bit eighths of an hour (7.5 minutes) */
+#define PROGRAM_TIME(hour, eighth) ((uint8_t)(((hour) << 3) | (eighth)))
+/* Temperatures: degC with 2 fractional bits, only positive */
+#define PROGRAM_TEMPERATURE(t) ((int16_t)(t) * 25)
+
+typedef struct
+{
+    uint8_t days; /* 0: empty slot */
+    uint8_t start;
+    uint8_t end; /* end <= start: ends on the next day */
+    uint8_t temperature;
+} program_t;
+
+void programInit(void);
+uint8_t programSet(uint8_t slot, const program_t *program);
+void programGet(uint8_t slot, program_t *program);
+void programSetRest(uint8_t temperature);
+uint8_t programGetRest(void);
+void programReschedule(void);
+void programPeriodic(void);
+uint32_t programNextRun(void);
+void programOverride(int16_t temperature, uint32_t duration);
+void programCancelOverride(void);
+void programBoost(void);
+uint8_t programHeatCommand(uint8_t temperature, uint8_t off);
+
+#define programClear(slot) programSet((slot), 0)
+
+#endif /* PROGRAM_H_ */
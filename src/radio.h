@@ -1,11 +1,15 @@
 #ifndef _RADIO_H_
 #define _RADIO_H_
+#include <stdint.h>
 /* This file defines a generic interface for all radios. Each supported radio should live in its own directory. */
 namespace Radio {
 void init(void);
 void periodic(void);
+uint32_t nextRun(void);
+void irq(void);
 enum radio_state_t {
     RADIO_DISABLED,
+    RADIO_POWERDOWN,
     RADIO_IDLE,
     RADIO_LISTENING,
     RADIO_TRANSMITTING
@@ -0,0 +1,196 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "rtc.h"
+#include "power.h"
+
+/* Timer 2 runs from the 32768 Hz crystal with a prescaler of 1024 => 32 Hz.
+ * It overflows every 8 seconds. */
+#define RTC_OVERFLOW_SECONDS (256 / RTC_TICKS_PER_SECOND)
+
+static volatile uint32_t rtc_overflows;
+/* Wall clock: seconds since Monday 00:00 at rtcGetSeconds() == 0, RTC_NEVER: not set */
+static uint32_t rtc_week_offset = RTC_NEVER;
+
+/* Drift compensation: the crystal error is estimated from the time between two syncs with the base
+ * station (rtcSync()) and corrected by adding or dropping single ticks at the overflows, so all times
+ * (rtcGetSeconds(), rtcGetTicks(), the wall clock) follow the base station between syncs.
+ * Base station time has a resolution of one second, an estimate needs RTC_SYNC_MIN_S between the syncs
+ * (1 s in 20 h: 14 ppm), each one corrects half of the remaining error. */
+#define RTC_SYNC_MIN_S (20 * 3600UL)
+#define RTC_SYNC_MAX_S (30 * 24 * 3600UL) /* reference too old, 1/32 per second below must not overflow */
+#define RTC_SYNC_STEP_S 2 /* the clock is only set if it is off by this much */
+#define RTC_PPM_MAX 500
+static volatile int32_t rtc_correction; /* ticks added to the crystal count */
+static int32_t rtc_drift; /* 1e-6 ticks, correction below one tick */
+static volatile int16_t rtc_ppm16; /* crystal error in 1/16 ppm, > 0: crystal is fast */
+static uint32_t rtc_sync_ticks; /* rtcGetTicks() at the reference sync */
+static uint32_t rtc_sync_seconds; /* base station time at the reference sync, 0: none */
+
+void rtcInit(void)
+{
+    TIMSK2 = 0;
+    ASSR = (1 << AS2);
+    TCNT2 = 0;
+    TCCR2A = (1 << CS22) | (1 << CS21) | (1 << CS20);
+    while (ASSR & ((1 << TCN2UB) | (1 << TCR2UB)))
+        /* wait for the asynchronous registers to be updated */
+        ;
+    TIFR2 = (1 << TOV2) | (1 << OCF2A);
+    TIMSK2 = (1 << TOIE2);
+}
+
+ISR(TIMER2_OVF_vect)
+{
+    pwrWake(PWR_WAKE_RTC);
+    rtc_overflows++;
+    rtc_drift += rtc_ppm16 * 16L; /* 256 ticks per overflow */
+    if (rtc_drift >= 1000000L) {
+        rtc_drift -= 1000000L;
+        rtc_correction--;
+    } else if (rtc_drift <= -1000000L) {
+        rtc_drift += 1000000L;
+        rtc_correction++;
+    }
+}
+
+/* Only wakes the CPU, see rtcWakeAt(). */
+ISR(TIMER2_COMP_vect)
+{
+    pwrWake(PWR_WAKE_ALARM);
+}
+
+static uint32_t rtcRead(uint8_t *ticks, int32_t *correction)
+{
+    uint32_t overflows;
+    uint8_t sreg = SREG;
+    cli();
+    overflows = rtc_overflows;
+    *correction = rtc_correction;
+    *ticks = TCNT2;
+    /* Overflow happened after disabling interrupts, but before reading TCNT2. */
+    if ((TIFR2 & (1 << TOV2)) && *ticks < 128) {
+        overflows++;
+    }
+    SREG = sreg;
+    return overflows;
+}
+
+/** Returns the seconds since system start. */
+uint32_t rtcGetSeconds(void)
+{
+    uint8_t ticks;
+    int32_t correction;
+    uint32_t seconds = rtcRead(&ticks, &correction) * RTC_OVERFLOW_SECONDS;
+    int32_t t = ticks + correction;
+    /* rounds down for negative corrections as well */
+    return t >= 0 ? seconds + t / RTC_TICKS_PER_SECOND : seconds - (RTC_TICKS_PER_SECOND - 1 - t) / RTC_TICKS_PER_SECOND;
+}
+
+/** Returns the ticks (1 / RTC_TICKS_PER_SECOND) since system start, for waits below a second. */
+uint32_t rtcGetTicks(void)
+{
+    uint8_t ticks;
+    int32_t correction;
+    return rtcRead(&ticks, &correction) * 256 + ticks + correction;
+}
+
+/**
+ * Arms the compare match to wake the CPU from sleep at the given time.
+ * The overflow wakes it every RTC_OVERFLOW_SECONDS anyway, so the compare match is only needed
+ * if the deadline is before the next overflow. Callers sleep in a loop until the deadline is reached.
+ */
+void rtcWakeAt(uint32_t seconds)
+{
+    uint32_t now = rtcGetSeconds();
+    if (seconds <= now || seconds - now >= RTC_OVERFLOW_SECONDS) {
+        TIMSK2 &= ~(1 << OCIE2A);
+        return;
+    }
+    rtcWakeAtTick(seconds * RTC_TICKS_PER_SECOND);
+}
+
+/** Same as rtcWakeAt() for a deadline in rtcGetTicks(). */
+void rtcWakeAtTick(uint32_t tick)
+{
+    uint8_t ticks;
+    int32_t correction;
+    uint32_t now = rtcRead(&ticks, &correction) * 256 + ticks + correction;
+    int32_t ahead = tick - now;
+    TIMSK2 &= ~(1 << OCIE2A);
+    if (ahead <= 0 || ahead >= 256) {
+        return;
+    }
+    uint16_t target = ticks + (uint16_t)ahead; /* the compare match counts crystal ticks */
+    if (target > 255) {
+        /* overflow comes first */
+        return;
+    }
+    OCR2A = target;
+    while (ASSR & (1 << OCR2UB))
+        /* compare register is written asynchronously */
+        ;
+    TIFR2 = (1 << OCF2A);
+    TIMSK2 |= (1 << OCIE2A);
+}
+
+/** Sets the wall clock, seconds since Monday 00:00 (local time). */
+void rtcSetWeekTime(uint32_t seconds)
+{
+    rtc_week_offset = (seconds % RTC_WEEK_SECONDS + RTC_WEEK_SECONDS - rtcGetSeconds() % RTC_WEEK_SECONDS)
+            % RTC_WEEK_SECONDS;
+}
+
+/**
+ * Takes the time of the base station: sets the clock if it is off and estimates the crystal error.
+ * @param seconds since a Monday 00:00 on a continuous scale, e.g. unix time + 3 days
+ */
+void rtcSync(uint32_t seconds)
+{
+    uint32_t now = rtcGetTicks();
+    uint32_t week = rtcGetWeekTime();
+    uint32_t off = (week + RTC_WEEK_SECONDS - seconds % RTC_WEEK_SECONDS) % RTC_WEEK_SECONDS;
+    if (week == RTC_NEVER || (off >= RTC_SYNC_STEP_S && off <= RTC_WEEK_SECONDS - RTC_SYNC_STEP_S)) {
+        rtcSetWeekTime(seconds);
+    }
+
+    uint32_t elapsed = seconds - rtc_sync_seconds;
+    if (rtc_sync_seconds && seconds > rtc_sync_seconds && elapsed < RTC_SYNC_MIN_S) {
+        /* keep the reference until the estimate is precise enough */
+        return;
+    }
+    if (rtc_sync_seconds && seconds > rtc_sync_seconds && elapsed <= RTC_SYNC_MAX_S) {
+        int32_t error = now - rtc_sync_ticks - elapsed * RTC_TICKS_PER_SECOND;
+        int32_t limit = elapsed / 32; /* ~1000 ppm, anything more is a jump of the base station time */
+        if (error < limit && error > -limit) {
+            /* remaining error in 1/16 ppm: error / (elapsed * 32) * 16e6 */
+            int32_t ppm16 = rtc_ppm16 + error * 15625L / (int32_t)(elapsed / 32) / 2;
+            if (ppm16 > RTC_PPM_MAX * 16) {
+                ppm16 = RTC_PPM_MAX * 16;
+            } else if (ppm16 < -RTC_PPM_MAX * 16) {
+                ppm16 = -RTC_PPM_MAX * 16;
+            }
+            uint8_t sreg = SREG;
+            cli();
+            rtc_ppm16 = ppm16;
+            SREG = sreg;
+        }
+    }
+    rtc_sync_ticks = now;
+    rtc_sync_seconds = seconds;
+}
+
+/** Returns the estimated crystal error in ppm, > 0: fast. */
+int16_t rtcGetDrift(void)
+{
+    return rtc_ppm16 / 16;
+}
+
+/** Returns the seconds since Monday 00:00 or RTC_NEVER if the clock was never set. */
+uint32_t rtcGetWeekTime(void)
+{
+    if (rtc_week_offset == RTC_NEVER) {
+        return RTC_NEVER;
+    }
+    return (rtcGetSeconds() % RTC_WEEK_SECONDS + rtc_week_offset) % RTC_WEEK_SECONDS;
+}
@@ -0,0 +1,21 @@
+/* Real time clock based on the asynchronous timer 2 and the 32 kHz crystal. */
+#ifndef RTC_H_
+#define RTC_H_
+#include <stdint.h>
+
+#define RTC_TICKS_PER_SECOND 32
+/* Deadline that never expires. */
+#define RTC_NEVER 0xFFFFFFFFUL
+#define RTC_WEEK_SECONDS (7 * 24 * 3600UL)
+
+void rtcInit(void);
+uint32_t rtcGetSeconds(void);
+uint32_t rtcGetTicks(void);
+void rtcWakeAt(uint32_t seconds);
+void rtcWakeAtTick(uint32_t tick);
+void rtcSetWeekTime(uint32_t seconds);
+uint32_t rtcGetWeekTime(void);
+void rtcSync(uint32_t seconds);
+int16_t rtcGetDrift(void);
+
+#endif /* RTC_H_ */
@@ -3,6 +3,7 @@
 
 #include <avr/io.h>
 #include <stdint.h>
+#include "power.h"
 
 /* Configure SPI in master mode, maximum speed (clock/2). */
 static inline void spiInit(void)
@@ -11,6 +12,19 @@ static inline void spiInit(void)
     SPSR = (1 << SPI2X);
 }
 
+/* Powers the SPI for a sequence of transfers, see pwrAcquire(). */
+static inline void spiAcquire(void)
+{
+    if (pwrAcquire(PRSPI)) {
+        spiInit();
+    }
+}
+
+static inline void spiRelease(void)
+{
+    pwrRelease(PRSPI);
+}
+
 namespace SPI {
 
 static inline uint8_t write(uint8_t data)
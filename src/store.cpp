@@ -0,0 +1,173 @@
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <stddef.h>
+
+#include "store.h"
+#include "control.h"
+#include "rtc.h"
+#include "debug.h"
+
+/* Record ring
+ *
+ * Records are written round robin into STORE_SLOTS slots, so each cell only sees every STORE_SLOTS-th write.
+ * The newest record is the valid one (version and CRC) with the highest sequence number, compared with
+ * wrap around. It is found by a single scan at boot. A record torn by a power loss fails its CRC and the
+ * previous one is used instead.
+ *
+ * Power loss: the shutdown record is kept serialised in RAM, only time and CRC are filled in when the power
+ * goes away. Its slot is prepared in the EEPROM in advance with everything but time and CRC, the CRC is
+ * deliberately wrong until then. So at most STORE_SHUTDOWN_BYTES have to be written on the hold-up capacitor.
+ * The slot is only prepared once the clock is set, without it the shutdown record has nothing to add.
+ * While the main loop writes the slot, store_prepared is 0 and the shutdown path leaves it alone.
+ */
+#define STORE_VERSION 2
+#define STORE_SLOTS 8
+#define STORE_NONE 0xFF
+
+static store_record_t EEMEM store_ring[STORE_SLOTS];
+
+static uint8_t store_newest = STORE_NONE; /* slot */
+static uint16_t store_sequence;
+static int16_t store_temperature; /* nominal temperature saved last */
+
+static store_record_t store_shutdown; /* pre-serialised shutdown record */
+static uint16_t store_shutdown_crc; /* CRC up to week_time */
+static uint8_t store_shutdown_slot;
+static uint8_t store_shutdown_byte; /* next byte to compare or write */
+static volatile uint8_t store_prepared; /* the slot holds the shutdown record but time and CRC */
+
+static uint16_t storeCrcUpdate(uint16_t crc, const void *data, uint8_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (uint8_t i = 0; i < n; i++) {
+        crc = _crc_ccitt_update(crc, p[i]);
+    }
+    return crc;
+}
+
+static uint16_t storeCrc(const store_record_t *record)
+{
+    return storeCrcUpdate(0xFFFF, record, offsetof(store_record_t, crc));
+}
+
+static uint8_t storeNextSlot(void)
+{
+    return store_newest == STORE_NONE || store_newest + 1 >= STORE_SLOTS ? 0 : store_newest + 1;
+}
+
+/* Serialises the shutdown record for the current state and prepares its slot. */
+static void storePrepareShutdown(void)
+{
+    store_prepared = 0;
+    if (rtcGetWeekTime() == RTC_NEVER) {
+        return;
+    }
+    store_shutdown.sequence = store_sequence + 1;
+    store_shutdown.version = STORE_VERSION;
+    store_shutdown.flags = STORE_SHUTDOWN;
+    store_shutdown.temperature = store_temperature;
+    store_shutdown_crc = storeCrcUpdate(0xFFFF, &store_shutdown, offsetof(store_record_t, week_time));
+    store_shutdown_slot = storeNextSlot();
+    /* current time, so only the changing low bytes of it are written later */
+    store_shutdown.week_time = rtcGetWeekTime();
+    store_shutdown.crc = ~storeCrc(&store_shutdown);
+    eeprom_update_block(&store_shutdown, &store_ring[store_shutdown_slot], sizeof(store_shutdown));
+    store_prepared = 1;
+}
+
+/** Finds the newest record and restores the nominal temperature and, after a power loss, the clock. */
+void storeInit(void)
+{
+    store_record_t record;
+    for (uint8_t i = 0; i < STORE_SLOTS; i++) {
+        eeprom_read_block(&record, &store_ring[i], sizeof(record));
+        if (record.version != STORE_VERSION || record.crc != storeCrc(&record)) {
+            continue;
+        }
+        if (store_newest == STORE_NONE || (int16_t)(record.sequence - store_sequence) > 0) {
+            store_newest = i;
+            store_sequence = record.sequence;
+        }
+    }
+    store_temperature = getNominalTemperature();
+    if (store_newest == STORE_NONE) {
+        storePrepareShutdown();
+        return;
+    }
+    eeprom_read_block(&record, &store_ring[store_newest], sizeof(record));
+    store_temperature = record.temperature;
+    setNominalTemperature(record.temperature);
+    if ((record.flags & STORE_SHUTDOWN) && record.week_time != RTC_NEVER) {
+        /* Off by the time without power, but better than no program at all. */
+        rtcSetWeekTime(record.week_time);
+    }
+    storePrepareShutdown();
+}
+
+/** Writes the current state into the next slot of the ring. */
+void storeSave(uint8_t flags)
+{
+    store_record_t record;
+    uint8_t slot = storeNextSlot();
+    store_prepared = 0; /* the same slot */
+    record.sequence = ++store_sequence;
+    record.version = STORE_VERSION;
+    record.flags = flags;
+    record.temperature = getNominalTemperature();
+    record.week_time = rtcGetWeekTime();
+    record.crc = storeCrc(&record);
+    eeprom_update_block(&record, &store_ring[slot], sizeof(record));
+    store_newest = slot;
+    store_temperature = record.temperature;
+    storePrepareShutdown();
+}
+
+/**
+ * Saves the state if it changed and prepares the shutdown record once the clock is set.
+ * Should be called from the main loop.
+ */
+void storePeriodic(void)
+{
+    if (getNominalTemperature() != store_temperature) {
+        storeSave(0);
+    } else if (!store_prepared && rtcGetWeekTime() != RTC_NEVER) {
+        storePrepareShutdown();
+    }
+}
+
+/**
+ * Power loss: completes the shutdown record and starts writing it. Writes nothing if the slot is not prepared.
+ * Has to be followed by storeShutdownStep() until it returns 0, other work can be done in between.
+ */
+void storeShutdownStart(void)
+{
+    if (!store_prepared) {
+        store_shutdown_byte = sizeof(store_shutdown);
+        return;
+    }
+    store_shutdown.week_time = rtcGetWeekTime();
+    store_shutdown.crc = storeCrcUpdate(store_shutdown_crc, &store_shutdown.week_time, sizeof(store_shutdown.week_time));
+    store_shutdown_byte = offsetof(store_record_t, week_time);
+    storeShutdownStep();
+}
+
+/**
+ * Starts the next EEPROM byte write of the shutdown record if the previous one is done. Does not block.
+ * @return 0 when the record is completely written and the EEPROM is idle
+ */
+uint8_t storeShutdownStep(void)
+{
+    uint8_t *dst = (uint8_t *)&store_ring[store_shutdown_slot];
+    const uint8_t *src = (const uint8_t *)&store_shutdown;
+    if (!eeprom_is_ready()) {
+        return 1;
+    }
+    while (store_shutdown_byte < sizeof(store_shutdown)) {
+        uint8_t i = store_shutdown_byte++;
+        if (eeprom_read_byte(dst + i) != src[i]) {
+            eeprom_write_byte(dst + i, src[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
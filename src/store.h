@@ -0,0 +1,38 @@
+/* Wear levelled record store for state which changes often (clock, set-point).
+ * The valve position is not stored: the adaptation at boot drives the motor to its end stops, which resets
+ * the tacho count anyway, and the controller sets the position again on its first run. */
+#ifndef STORE_H_
+#define STORE_H_
+#include <stdint.h>
+
+/* flags */
+#define STORE_SHUTDOWN 0x01 /* written on power loss, so the clock is still valid */
+
+typedef struct
+{
+    uint16_t sequence; /* incremented with each record, the highest one is the newest */
+    uint8_t version;
+    uint8_t flags;
+    int16_t temperature; /* nominal temperature */
+    uint32_t week_time; /* rtcGetWeekTime(), last so the CRC up to here can be prepared */
+    uint16_t crc; /* CRC-CCITT of all bytes above */
+} store_record_t;
+
+/* Bytes the shutdown record writes at most: the prepared slot only differs in time and CRC.
+ * Trade-offs of the prepared slot:
+ * - wear: with the clock set each save also prepares the next slot, so the ring sees two record writes
+ *   per save. With the program's few saves a day each cell gets about one write a day, far below the
+ *   100000 cycles of the EEPROM.
+ * - the shutdown runs in the power loss interrupt, also in the middle of a main loop EEPROM write:
+ *   sysShutdown() keeps EEAR and EEDR of the interrupted write and returns with the EEPROM idle. A save
+ *   of the store itself writes the prepared slot, the shutdown record is skipped then and the newest
+ *   complete record is restored without the clock. */
+#define STORE_SHUTDOWN_BYTES (sizeof(uint32_t) + sizeof(uint16_t))
+
+void storeInit(void);
+void storeSave(uint8_t flags);
+void storePeriodic(void);
+void storeShutdownStart(void);
+uint8_t storeShutdownStep(void);
+
+#endif /* STORE_H_ */
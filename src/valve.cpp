@@ -0,0 +1,133 @@
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#include "valve.h"
+#include "motor.h"
+#include "motion.h"
+#include "config.h"
+#include "debug.h"
+
+/* Valve characteristic
+ *
+ * Motor position 0 is the fully closed end stop, the valve seat is reached somewhere above it
+ * (contact point). Between 0 and the contact point the valve is closed and moving there only costs energy.
+ * Above the contact point typical radiator valves are strongly non-linear: most of the flow is reached
+ * within the first third of the stroke.
+ *
+ * The stroke breakpoints map flow (0-255) to stroke above the contact point (0-255 of the
+ * remaining range). Values in between are interpolated linearly.
+ */
+#define VALVE_CONFIG_VERSION 1
+/* Only write a new contact point to EEPROM if it moved by more than this. */
+#define VALVE_CONTACT_HYSTERESIS 4
+
+struct valve_config_t
+{
+    uint8_t version;
+    int16_t contact; /* motor counts, 0: unknown */
+    uint8_t stroke[VALVE_CURVE_POINTS];
+};
+
+static valve_config_t EEMEM valve_eeconfig;
+
+static const uint8_t DefaultStroke[VALVE_CURVE_POINTS] PROGMEM = { 0, 20, 50, 110, 255 };
+
+static valve_config_t valve_config;
+static uint8_t valve_flow;
+
+static void valveSave(void)
+{
+    eeprom_update_block(&valve_config, &valve_eeconfig, sizeof(valve_config));
+}
+
+void valveInit(void)
+{
+    eeprom_read_block(&valve_config, &valve_eeconfig, sizeof(valve_config));
+    if (valve_config.version != VALVE_CONFIG_VERSION) {
+        valve_config.version = VALVE_CONFIG_VERSION;
+        valve_config.contact = 0;
+        for (uint8_t i = 0; i < VALVE_CURVE_POINTS; i++) {
+            valve_config.stroke[i] = pgm_read_byte(&DefaultStroke[i]);
+        }
+    }
+}
+
+/**
+ * Takes over the contact point the motor detected during its last closing run.
+ * Should be called after adaptation and after each valve move.
+ */
+void valveLearn(void)
+{
+    static int16_t last_detected;
+    int16_t contact = motorGetContactPosition();
+    int16_t old = valve_config.contact;
+    if (contact <= 0 || contact >= motorGetMaxPosition() || contact == last_detected) {
+        return;
+    }
+    last_detected = contact;
+    if (old) {
+        /* Low pass, a single slow run (e.g. low battery) should not move the curve too much. */
+        contact = (3 * old + contact) / 4;
+    }
+    valve_config.contact = contact;
+    if (contact - old > VALVE_CONTACT_HYSTERESIS || old - contact > VALVE_CONTACT_HYSTERESIS) {
+        debugString("Valve contact ");
+        debugNumber(contact);
+        valveSave();
+    }
+}
+
+/**
+ * Sets a new stroke curve.
+ * @param stroke VALVE_CURVE_POINTS values, stroke above the contact point (0-255) for each flow breakpoint.
+ * Values are forced to be monotonic.
+ */
+void valveSetCurve(const uint8_t *stroke)
+{
+    uint8_t last = 0;
+    for (uint8_t i = 0; i < VALVE_CURVE_POINTS; i++) {
+        if (stroke[i] > last) {
+            last = stroke[i];
+        }
+        valve_config.stroke[i] = last;
+    }
+    valveSave();
+}
+
+/** Returns the motor position for the given flow (0: closed, 255: fully open). */
+int16_t valveFlowToPosition(uint8_t flow)
+{
+    int16_t max = motorGetMaxPosition();
+    int16_t contact = valve_config.contact;
+    if (flow == 0) {
+        return 0;
+    }
+    if (flow == 255) {
+        return max;
+    }
+    if (contact >= max) {
+        contact = 0;
+    }
+    uint8_t i = flow / VALVE_FLOW_STEP;
+    uint8_t frac = flow % VALVE_FLOW_STEP;
+    uint8_t lo = valve_config.stroke[i];
+    uint8_t hi = valve_config.stroke[i + 1];
+    uint8_t stroke = lo + (uint16_t)(hi - lo) * frac / VALVE_FLOW_STEP;
+    return contact + (int32_t)(max - contact) * stroke / 255;
+}
+
+void valveSetFlow(uint8_t flow)
+{
+    valve_flow = flow;
+    motionRequest(valveFlowToPosition(flow));
+}
+
+uint8_t valveGetFlow(void)
+{
+    return valve_flow;
+}
+
+int16_t valveGetContact(void)
+{
+    return valve_config.contact;
+}
@@ -0,0 +1,19 @@
+/* Linearised valve opening on top of the raw motor position. */
+#ifndef VALVE_H_
+#define VALVE_H_
+#include <stdint.h>
+
+/* Number of stroke breakpoints. Breakpoint i belongs to flow i * VALVE_FLOW_STEP,
+ * the last one to fully open. */
+#define VALVE_CURVE_POINTS 5
+#define VALVE_FLOW_STEP (256 / (VALVE_CURVE_POINTS - 1))
+
+void valveInit(void);
+void valveLearn(void);
+void valveSetCurve(const uint8_t *stroke);
+void valveSetFlow(uint8_t flow);
+uint8_t valveGetFlow(void);
+int16_t valveFlowToPosition(uint8_t flow);
+int16_t valveGetContact(void);
+
+#endif /* VALVE_H_ */
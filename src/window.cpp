@@ -0,0 +1,84 @@
+#include "window.h"
+#include "control.h"
+#include "rtc.h"
+#include "config.h"
+#include "debug.h"
+
+/* The temperature is low pass filtered and put into a small ring at most every WINDOW_SAMPLE_S.
+ * Samples come with each wakeup, which is only every few minutes in steady state, so every entry keeps
+ * its time. A drop of more than WINDOW_DROP from any entry younger than WINDOW_SPAN_S means an open window.
+ * The valve is then closed for WINDOW_CLOSE_S. Afterwards detection is suspended for WINDOW_BACKOFF_S,
+ * as the room recovers from the cold air. The controller runs right at the detection and at the end of
+ * both periods, see windowNextChange(). */
+#define WINDOW_SAMPLES 6
+#define WINDOW_SAMPLE_S (WINDOW_SPAN_S / WINDOW_SAMPLES)
+
+uint8_t window_detections;
+
+static int16_t window_filtered;
+static int16_t window_history[WINDOW_SAMPLES];
+static uint16_t window_time[WINDOW_SAMPLES]; /* lower 16 bit of rtcGetSeconds() */
+static uint8_t window_index;
+static uint8_t window_valid; /* number of history entries filled */
+static uint32_t window_next_sample;
+static uint32_t window_open_until;
+/* No detection right after boot, the NTC still settles after mounting or a battery change. */
+static uint32_t window_backoff_until = WINDOW_CLOSE_S;
+
+/* Called with each new temperature sample (0.01 degC). */
+void windowUpdate(int16_t temperature)
+{
+    uint32_t now = rtcGetSeconds();
+    int16_t highest;
+
+    if (!window_valid) {
+        window_filtered = temperature;
+    }
+    window_filtered += (temperature - window_filtered) >> 2;
+
+    highest = window_filtered;
+    for (uint8_t i = 0; i < window_valid; i++) {
+        if ((uint16_t)((uint16_t)now - window_time[i]) <= WINDOW_SPAN_S && window_history[i] > highest) {
+            highest = window_history[i];
+        }
+    }
+
+    if (now >= window_next_sample) {
+        window_next_sample = now + WINDOW_SAMPLE_S;
+        window_history[window_index] = window_filtered;
+        window_time[window_index] = now;
+        window_index = window_index + 1 < WINDOW_SAMPLES ? window_index + 1 : 0;
+        if (window_valid < WINDOW_SAMPLES) {
+            window_valid++;
+        }
+    }
+
+    if (now < window_backoff_until) {
+        return;
+    }
+    if (highest - window_filtered > WINDOW_DROP) {
+        window_open_until = now + WINDOW_CLOSE_S;
+        window_backoff_until = window_open_until + WINDOW_BACKOFF_S;
+        window_detections++;
+        debugString("Window open\r\n");
+        controlRunNow();
+    }
+}
+
+uint8_t windowIsOpen(void)
+{
+    return window_open_until && rtcGetSeconds() < window_open_until;
+}
+
+/** Returns when the valve may open again or the detection resumes (rtc seconds), RTC_NEVER if neither is ahead. */
+uint32_t windowNextChange(void)
+{
+    uint32_t now = rtcGetSeconds();
+    if (now < window_open_until) {
+        return window_open_until;
+    }
+    if (now < window_backoff_until) {
+        return window_backoff_until;
+    }
+    return RTC_NEVER;
+}
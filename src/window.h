@@ -0,0 +1,12 @@
+/* Open window detection from the temperature slope. */
+#ifndef WINDOW_H_
+#define WINDOW_H_
+#include <stdint.h>
+
+void windowUpdate(int16_t temperature);
+uint8_t windowIsOpen(void);
+uint32_t windowNextChange(void);
+
+extern uint8_t window_detections; /* wraps around */
+
+#endif /* WINDOW_H_ */